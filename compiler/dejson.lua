@@ -18,7 +18,9 @@ parse = function(file)
     uint32 = true,
     uint64 = true,
     bool = true,
-    string = true
+    string = true,
+    json = true,
+    bytes = true
   }
 
   local parser = {
@@ -38,11 +40,12 @@ parse = function(file)
         source = source,
         file = file,
         language = 'cpp',
-        symbols = {'{', '}', '[', ']', '<', '>', '*', ';'},
+        symbols = {'{', '}', '[', ']', '<', '>', '*', ';', ',', '=', '@', '(', ')'},
         keywords = {
-          'struct', 'signed', 'unsigned', 'char', 'short', 'int', 'long',
+          'struct', 'enum', 'signed', 'unsigned', 'char', 'short', 'int', 'long',
           'int8_t', 'int16_t', 'int32_t', 'int64_t', 'uint8_t', 'uint16_t',
-          'uint32_t', 'uint64_t', 'float', 'double', 'bool', 'string'
+          'uint32_t', 'uint64_t', 'float', 'double', 'bool', 'string', 'json', 'bytes', 'map',
+          'optional'
         }
       }
 
@@ -85,23 +88,83 @@ parse = function(file)
     end,
 
     parseAggregates = function(self)
-      local aggregates = {}
+      local aggregates = {enums = {}}
       local ids = {}
 
-      while self.la.token == 'struct' do
-        local struct = self:parseStruct()
+      while self.la.token == 'struct' or self.la.token == 'enum' do
+        local aggregate
 
-        if ids[struct.id] then
-          self:error(struct.line, 'duplicated aggregate: ', struct.id)
+        if self.la.token == 'struct' then
+          aggregate = self:parseStruct()
+          aggregates[#aggregates + 1] = aggregate
+        else
+          aggregate = self:parseEnum()
+          aggregates.enums[#aggregates.enums + 1] = aggregate
+        end
+
+        if ids[aggregate.id] then
+          self:error(aggregate.line, 'duplicated aggregate: ', aggregate.id)
         end
 
-        aggregates[#aggregates + 1] = struct
-        ids[struct.id] = struct
+        ids[aggregate.id] = aggregate
       end
 
       return aggregates
     end,
 
+    parseEnum = function(self)
+      local enum = {values = {}}
+      local ids = {}
+      local names = {}
+
+      self:match('enum')
+      enum.id = self.la.lexeme
+      enum.line = self.la.line
+      self:match('<id>')
+      self:match('{')
+
+      while true do
+        local value = {id = self.la.lexeme, line = self.la.line}
+        self:match('<id>')
+
+        if self.la.token == '=' then
+          self:match()
+
+          -- Names that aren't valid identifiers are given as strings
+          value.name = self.la.lexeme:sub(2, -2):gsub('\\(.)', '%1')
+          self:match('<string>')
+        else
+          value.name = value.id
+        end
+
+        if value.id == 'UNKNOWN' then
+          self:error(value.line, 'UNKNOWN is reserved for values not in the enumeration')
+        elseif ids[value.id] then
+          self:error(value.line, 'duplicated value: ', value.id)
+        elseif names[value.name] then
+          self:error(value.line, 'duplicated name: ', value.name)
+        end
+
+        enum.values[#enum.values + 1] = value
+        ids[value.id] = value
+        names[value.name] = value
+
+        if self.la.token ~= ',' then
+          break
+        end
+
+        self:match()
+
+        if self.la.token == '}' then
+          break
+        end
+      end
+
+      self:match('}')
+      self:match(';')
+      return enum
+    end,
+
     parseStruct = function(self)
       local struct = {fields = {}}
       local ids = {}
@@ -138,9 +201,35 @@ parse = function(file)
         isUnsigned = false,
         isScalar = true,
         isArray = false,
-        isPointer = false
+        isPointer = false,
+        isMap = false
       }
 
+      if self.la.token == 'map' then
+        self:match()
+        self:match('<')
+
+        if self.la.token ~= 'string' then
+          self:error(self.la.line, 'map keys must be strings')
+        end
+
+        self:match()
+        self:match(',')
+
+        local line = self.la.line
+        type = self:parseType()
+
+        if type.isPointer then
+          self:error(line, 'maps of pointers are not supported')
+        elseif type.isMap then
+          self:error(line, 'maps of maps are not supported')
+        end
+
+        self:match('>')
+        type.isMap = true
+        return type
+      end
+
       if self.la.token == 'signed' then
         type.isSigned = true
         self:match()
@@ -171,7 +260,7 @@ parse = function(file)
       elseif t == 'int8_t' or t == 'int16_t' or t == 'int32_t' or
              t == 'int64_t' or t == 'uint8_t' or t == 'uint16_t' or
              t == 'uint32_t' or t == 'uint64_t' or t == 'float' or
-             t == 'double' or t == 'bool' or t == 'string' then
+             t == 'double' or t == 'bool' or t == 'string' or t == 'json' or t == 'bytes' then
         if type.isSigned or type.isUnsigned then
           self:error(self.la.line, '"signed" or "unsigned" invalid with "', self.la.lexeme, '"')
         end
@@ -204,6 +293,30 @@ parse = function(file)
     parseStructField = function(self)
       local field = {}
 
+      while self.la.token == '@' do
+        self:match()
+        local annotation = self.la.lexeme
+        local line = self.la.line
+        self:match('<id>')
+
+        if annotation == 'quoted' then
+          field.quoted = true
+        elseif annotation == 'convert' then
+          self:match('(')
+          field.converter = self.la.lexeme
+          self:match('<id>')
+          self:match(')')
+        else
+          self:error(line, 'unknown annotation: ', annotation)
+        end
+      end
+
+      if self.la.token == 'optional' then
+        field.optional = true
+        self:match()
+      end
+
+      local line = self.la.line
       field.type = self:parseType()
 
       field.id = self.la.lexeme
@@ -211,8 +324,16 @@ parse = function(file)
       self:match('<id>')
 
       if self.la.token == '[' then
-        if field.type.isScalar then
+        if field.type.isMap then
+          self:error(self.la.line, 'arrays of maps are not supported')
+        elseif field.type.isScalar then
           self:match()
+
+          if self.la.token == '<id>' then
+            field.type.key = self.la.lexeme
+            self:match()
+          end
+
           self:match(']')
 
           field.type.isArray = true
@@ -221,6 +342,10 @@ parse = function(file)
         end
       end
 
+      if field.optional and (field.type.isPointer or field.type.isArray or field.type.isMap) then
+        self:error(line, 'optional fields can\'t be pointers, arrays or maps')
+      end
+
       self:match(';')
       return field
     end
@@ -247,6 +372,8 @@ parse = function(file)
     uint64_t = 1,
     -- 8 or 4 bytes
     string = 2,
+    json = 2,
+    bytes = 2,
     long = 2,
     -- 4 bytes
     float = 3,
@@ -280,25 +407,111 @@ parse = function(file)
     int16_t = 'DEJSON_TYPE_INT16',
     int32_t = 'DEJSON_TYPE_INT32',
     int64_t = 'DEJSON_TYPE_INT64',
-    uint8_y = 'DEJSON_TYPE_UINT8',
+    uint8_t = 'DEJSON_TYPE_UINT8',
     uint16_t = 'DEJSON_TYPE_UINT16',
     uint32_t = 'DEJSON_TYPE_UINT32',
     uint64_t = 'DEJSON_TYPE_UINT64',
     float = 'DEJSON_TYPE_FLOAT',
     double = 'DEJSON_TYPE_DOUBLE',
     bool = 'DEJSON_TYPE_BOOL',
-    string = 'DEJSON_TYPE_STRING'
+    string = 'DEJSON_TYPE_STRING',
+    json = 'DEJSON_TYPE_JSON',
+    bytes = 'DEJSON_TYPE_BYTES'
   }
 
+  local cstring = function(str)
+    return '"' .. str:gsub('[%c"\\]', function(c) return string.format('\\%03o', c:byte()) end) .. '"'
+  end
+
+  local enums = {}
+
+  for i = 1, #ast.enums do
+    local enum = ast.enums[i]
+    local hashes = {}
+
+    enum.hash = hash(enum.id)
+    enums[enum.id] = enum
+
+    for j = 1, #enum.values do
+      local value = enum.values[j]
+      value.hash = hash(value.name)
+      value.cname = cstring(value.name)
+
+      if hashes[value.hash] then
+        parser:error(value.line, 'names ', hashes[value.hash].name, ' and ', value.name, ' have the same hash')
+      end
+
+      hashes[value.hash] = value
+    end
+
+    -- Zero is reserved for unknown values
+    if #enum.values < 0x100 then
+      enum.size, enum.ctype, size[enum.id] = 1, 'uint8_t', 5
+    elseif #enum.values < 0x10000 then
+      enum.size, enum.ctype, size[enum.id] = 2, 'uint16_t', 4
+    else
+      enum.size, enum.ctype, size[enum.id] = 4, 'uint32_t', 3
+    end
+
+    -- Look for a multiplier that sends all values to different slots, growing the table when it takes too long
+    local bits = 0
+
+    while (1 << bits) < #enum.values do
+      bits = bits + 1
+    end
+
+    local multiplier = 0x9e3779b1
+
+    while not enum.slots do
+      local mask = (1 << bits) - 1
+      local shift = 32 - (bits > 0 and bits or 1)
+
+      for _ = 1, 100000 do
+        local slots = {}
+
+        for j = 1, #enum.values do
+          local ndx = (((enum.values[j].hash * multiplier) & 0xffffffff) >> shift) & mask
+
+          if slots[ndx] then
+            slots = nil
+            break
+          end
+
+          slots[ndx] = j
+        end
+
+        if slots then
+          enum.slots, enum.multiplier, enum.shift, enum.mask = {}, multiplier, shift, mask
+
+          for ndx = 0, mask do
+            enum.slots[ndx + 1] = enum.values[slots[ndx]] or {hash = 0, id = false}
+          end
+
+          break
+        end
+
+        multiplier = ((multiplier * 0x2c1b3c6d + 0x297a2d39) & 0xffffffff) | 1
+      end
+
+      bits = bits + 1
+    end
+  end
+
+  local converters = {}
+  ast.converters = {}
+
   for i = 1, #ast do
     ast[i].hash = hash(ast[i].id)
 
     table.sort(ast[i].fields, function(f1, f2)
-      local s1 = f1.type.isPointer and 2 or size[f1.type.id] or 2
-      local s2 = f2.type.isPointer and 2 or size[f2.type.id] or 2
+      local s1 = (f1.type.isPointer or f1.type.isMap) and 2 or size[f1.type.id] or 2
+      local s2 = (f2.type.isPointer or f2.type.isMap) and 2 or size[f2.type.id] or 2
       return s1 < s2
     end)
 
+    -- Optional fields get two bits each in the presence bitmap, present and null
+    ast[i].optionals = 0
+
     for j = 1, #ast[i].fields do
       local field = ast[i].fields[j]
       local t = field.type
@@ -317,27 +530,232 @@ parse = function(file)
 
       if type == 'string' then
         type = 'dejson_string_t'
+      elseif type == 'json' then
+        type = 'dejson_json_t'
+      elseif type == 'bytes' then
+        type = 'dejson_bytes_t'
       elseif type == 'bool' then
         type = 'char'
       end
 
-      if t.isArray then
-        field.decl = string.format('dejson_array_t %s;', field.id)
-      else
-        field.decl = string.format('%s%s%s %s;', sig, type, t.isPointer and '*' or '', field.id)
-      end
+      field.ctype = sig .. type
 
       if t.isUnsigned then
         field.dejson = unsigned[t.id]
+      elseif enums[t.id] then
+        -- Enumerations are stored with the smallest type that fits, not as a C enum
+        field.dejson = 'DEJSON_TYPE_ENUM'
+        type = enums[t.id].ctype
+        field.ctype = type
       else
         field.dejson = signed[t.id] or 'DEJSON_TYPE_RECORD'
       end
+
+      field.typeHash = (field.dejson == 'DEJSON_TYPE_RECORD' or field.dejson == 'DEJSON_TYPE_ENUM') and t.hash or 0
+
+      if field.dejson == 'DEJSON_TYPE_RECORD' then
+        -- The struct tag keeps the header valid C++ when a field is named after its type
+        type = 'struct ' .. type
+      end
+
+      local native = field.dejson ~= 'DEJSON_TYPE_RECORD' and field.dejson ~= 'DEJSON_TYPE_ENUM' and
+                     field.dejson ~= 'DEJSON_TYPE_STRING' and field.dejson ~= 'DEJSON_TYPE_JSON' and
+                     field.dejson ~= 'DEJSON_TYPE_BYTES'
+
+      if field.quoted and field.converter then
+        parser:error(field.line, 'converted fields can\'t be quoted')
+      elseif (field.quoted or field.converter) and not native then
+        parser:error(field.line, 'only numbers and booleans can be quoted or converted')
+      elseif field.converter then
+        field.typeHash = hash(field.converter)
+
+        if not converters[field.converter] then
+          ast.converters[#ast.converters + 1] = {id = field.converter, hash = field.typeHash}
+          converters[field.converter] = true
+        end
+      end
+
+      if t.key then
+        field.decl = string.format('dejson_indexed_array_t %s;', field.id)
+        field.flags = 'DEJSON_FLAG_ARRAY | DEJSON_FLAG_INDEXED'
+      elseif t.isArray then
+        field.decl = string.format('dejson_array_t %s;', field.id)
+        field.flags = 'DEJSON_FLAG_ARRAY'
+      elseif t.isMap then
+        field.decl = string.format('dejson_map_t %s;', field.id)
+        field.flags = 'DEJSON_FLAG_MAP'
+      elseif t.isPointer then
+        field.decl = string.format('%s%s* %s;', sig, type, field.id)
+        field.flags = 'DEJSON_FLAG_POINTER'
+      else
+        field.decl = string.format('%s%s %s;', sig, type, field.id)
+        field.flags = '0'
+      end
+
+      if field.quoted or field.converter then
+        local flag = field.quoted and 'DEJSON_FLAG_QUOTED' or 'DEJSON_FLAG_CONVERTED'
+        field.flags = field.flags == '0' and flag or field.flags .. ' | ' .. flag
+      end
+
+      if field.optional then
+        field.bit = ast[i].optionals * 2
+        field.flags = field.flags == '0' and 'DEJSON_FLAG_OPTIONAL' or field.flags .. ' | DEJSON_FLAG_OPTIONAL'
+        ast[i].optionals = ast[i].optionals + 1
+      end
+
+      if field.id == 'dejson_presence' then
+        parser:error(field.line, 'dejson_presence is reserved for the presence bitmap')
+      end
+    end
+  end
+
+  local records = {}
+
+  for i = 1, #ast do
+    records[ast[i].id] = ast[i]
+    ast[i].finders = {}
+  end
+
+  for i = 1, #ast do
+    for j = 1, #ast[i].fields do
+      local field = ast[i].fields[j]
+      local t = field.type
+
+      if t.key then
+        local element = records[t.id]
+
+        if not element then
+          parser:error(field.line, 'only arrays of structures can be indexed')
+        end
+
+        local key
+
+        for k = 1, #element.fields do
+          if element.fields[k].id == t.key then
+            key = element.fields[k]
+            break
+          end
+        end
+
+        if not key then
+          parser:error(field.line, 'unknown key field: ', t.key)
+        end
+
+        local kt = key.type
+
+        if kt.isArray or kt.isPointer or kt.isMap or key.dejson == 'DEJSON_TYPE_RECORD' or
+           key.dejson == 'DEJSON_TYPE_ENUM' or key.dejson == 'DEJSON_TYPE_FLOAT' or key.dejson == 'DEJSON_TYPE_DOUBLE' or
+           key.dejson == 'DEJSON_TYPE_BOOL' or key.dejson == 'DEJSON_TYPE_JSON' or
+           key.dejson == 'DEJSON_TYPE_BYTES' then
+          parser:error(field.line, 'key fields must be integers or strings')
+        end
+
+        t.keyHash = hash(t.key)
+
+        if not element.finders[t.key] then
+          local decl = string.format('%s %s', kt.id == 'string' and 'const char*' or key.ctype, key.id)
+          element.finders[#element.finders + 1] = {id = key.id, decl = decl}
+          element.finders[t.key] = true
+        end
+      end
     end
   end
 
   return ast
 end
 
+local cpp = function(ast, namespace)
+  local records = {}
+
+  for i = 1, #ast do
+    records[ast[i].id] = ast[i]
+
+    if ast[i].id == namespace then
+      error(string.format('structure %s clashes with the C++ namespace', namespace))
+    end
+  end
+
+  for i = 1, #ast.enums do
+    if ast.enums[i].id == namespace then
+      error(string.format('enumeration %s clashes with the C++ namespace', namespace))
+    end
+  end
+
+  for i = 1, #ast do
+    local aggregate = ast[i]
+    aggregate.accessors = {}
+
+    for j = 1, #aggregate.fields do
+      local field = aggregate.fields[j]
+      local t = field.type
+      local view, stored
+
+      if field.dejson == 'DEJSON_TYPE_RECORD' then
+        view, stored = namespace .. '::' .. t.id, '::' .. t.id
+      elseif field.dejson == 'DEJSON_TYPE_ENUM' then
+        view, stored = '::' .. t.id, field.ctype
+      elseif t.id == 'string' then
+        view, stored = 'std::string_view', 'dejson_string_t'
+      elseif t.id == 'json' then
+        view, stored = 'std::string_view', 'dejson_json_t'
+      elseif t.id == 'bytes' then
+        view, stored = 'std::string_view', 'dejson_bytes_t'
+      elseif t.id == 'bool' then
+        view, stored = 'bool', 'char'
+      else
+        view, stored = field.ctype, field.ctype
+      end
+
+      -- A member can't have the same name as its class in C++
+      local accessor = {id = field.id == aggregate.id and field.id .. '_' or field.id}
+      aggregate.accessors[#aggregate.accessors + 1] = accessor
+
+      if t.isArray then
+        accessor.type = string.format('dejson::array_view<%s, %s>', view, stored)
+        accessor.body = string.format('%s(record_->%s)', accessor.type, field.id)
+      elseif t.isMap then
+        accessor.type = string.format('dejson::map_view<%s, %s>', view, stored)
+        accessor.body = string.format('%s(record_->%s)', accessor.type, field.id)
+      elseif t.isPointer then
+        accessor.type = string.format('std::optional<%s>', view)
+        accessor.body = string.format('dejson::detail::convert_pointer<%s>(record_->%s)', view, field.id)
+      elseif field.optional then
+        local bit = string.format('::%s_%s_BIT', aggregate.id, field.id)
+        accessor.type = string.format('std::optional<%s>', view)
+        accessor.body = string.format('DEJSON_IS_PRESENT(*record_, %s) ? %s(dejson::detail::convert<%s>(record_->%s)) : std::nullopt', bit, accessor.type, view, field.id)
+
+        aggregate.accessors[#aggregate.accessors + 1] = {
+          id = accessor.id .. '_is_null',
+          type = 'bool',
+          body = string.format('DEJSON_IS_NULL(*record_, %s) != 0', bit)
+        }
+      else
+        accessor.type = view
+        accessor.body = string.format('dejson::detail::convert<%s>(record_->%s)', view, field.id)
+      end
+
+      if t.key then
+        local element = records[t.id]
+        local key
+
+        for k = 1, #element.fields do
+          if element.fields[k].id == t.key then
+            key = element.fields[k]
+            break
+          end
+        end
+
+        aggregate.accessors[#aggregate.accessors + 1] = {
+          id = string.format('%s_find_by_%s', field.id, t.key),
+          type = string.format('std::optional<%s>', view),
+          decl = string.format('%s %s', key.type.id == 'string' and 'const char*' or key.ctype, key.id),
+          body = string.format('dejson::detail::convert_pointer<%s>(%s_find_by_%s(&record_->%s, %s))', view, t.id, t.key, field.id, key.id)
+        }
+      end
+    end
+  end
+end
+
 local header = [[
 #ifndef /*= args.guard */
 #define /*= args.guard */
@@ -345,34 +763,175 @@ local header = [[
 #include <dejson.h>
 #include <stdint.h>
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*! for _, enum in ipairs(args.ast.enums) do */
+typedef enum {
+  /*= enum.id */_UNKNOWN,
+/*!   for _, value in ipairs(enum.values) do */
+  /*= enum.id */_/*= value.id */,
+/*!   end */
+}
+/*= enum.id */;
+
+extern const dejson_enum_meta_t g_Meta/*= enum.id */;
+/*! end */
 /*! for _, aggregate in ipairs(args.ast) do */
-typedef struct {
+typedef struct /*= aggregate.id */ {
 /*!   for _, field in ipairs(aggregate.fields) do */
   /*= field.decl */
 /*!   end */
+/*!   if aggregate.optionals ~= 0 then */
+  uint8_t dejson_presence[/*= (aggregate.optionals * 2 + 7) // 8 */];
+/*!   end */
 }
 /*= aggregate.id */;
+/*!   if aggregate.optionals ~= 0 then */
+
+enum {
+/*!     for _, field in ipairs(aggregate.fields) do */
+/*!       if field.optional then */
+  /*= aggregate.id */_/*= field.id */_BIT = /*= field.bit */,
+/*!       end */
+/*!     end */
+};
+/*!   end */
 
 extern const dejson_record_meta_t g_Meta/*= aggregate.id */;
+/*!   for _, finder in ipairs(aggregate.finders) do */
+const /*= aggregate.id */* /*= aggregate.id */_find_by_/*= finder.id */(const dejson_indexed_array_t* array, /*= finder.decl */);
+/*!   end */
+/*! end */
+
+/*! for _, converter in ipairs(args.ast.converters) do */
+int /*= converter.id */(void* value, const char* chars, size_t length);
 /*! end */
 
 const dejson_record_meta_t* dejson_resolve_record(uint32_t hash);
+const dejson_enum_meta_t* dejson_resolve_enum(uint32_t hash);
+dejson_converter_t dejson_resolve_converter(uint32_t hash);
+
+#ifdef __cplusplus
+}
+#endif
 
 #endif /* /*= args.guard */ */
 ]]
 
+local wrapper = [[
+#ifndef /*= args.hppGuard */
+#define /*= args.hppGuard */
+
+#include "/*= args.include */"
+#include <dejson.hpp>
+
+#include <stddef.h>
+
+namespace /*= args.namespace */ {
+/*! for _, aggregate in ipairs(args.ast) do */
+  class /*= aggregate.id */;
+/*! end */
+/*! for _, aggregate in ipairs(args.ast) do */
+
+  class /*= aggregate.id */ {
+  public:
+    typedef ::/*= aggregate.id */ record_type;
+
+    static constexpr uint32_t name_hash = /*= string.format('0x%08xU', aggregate.hash) */;
+
+    static constexpr dejson::field_info fields[] = {
+/*!   for _, field in ipairs(aggregate.fields) do */
+      {"/*= field.id */", /*= string.format('0x%08xU', field.hash) */, /*= string.format('0x%08xU', field.typeHash) */, offsetof(::/*= aggregate.id */, /*= field.id */), /*= field.dejson */, /*= field.flags */, /*= field.bit or 0 */},
+/*!   end */
+    };
+
+    /*= aggregate.id */() : record_(nullptr) {}
+    explicit /*= aggregate.id */(const ::/*= aggregate.id */& record) : record_(&record) {}
+
+    const ::/*= aggregate.id */& record() const { return *record_; }
+
+/*!   for _, accessor in ipairs(aggregate.accessors) do */
+    /*= accessor.type */ /*= accessor.id */(/*= accessor.decl or '' */) const;
+/*!   end */
+
+  private:
+    const ::/*= aggregate.id */* record_;
+  };
+/*! end */
+/*! for _, aggregate in ipairs(args.ast) do */
+/*!   for _, accessor in ipairs(aggregate.accessors) do */
+
+  inline /*= accessor.type */ /*= aggregate.id */::/*= accessor.id */(/*= accessor.decl or '' */) const {
+    return /*= accessor.body */;
+  }
+/*!   end */
+/*! end */
+}
+/*! for _, enum in ipairs(args.ast.enums) do */
+
+template<> struct dejson::meta_of<::/*= enum.id */> {
+  static constexpr const dejson_enum_meta_t* get() { return &g_Meta/*= enum.id */; }
+};
+/*! end */
+/*! for _, aggregate in ipairs(args.ast) do */
+
+template<> struct dejson::meta_of<::/*= aggregate.id */> {
+  static constexpr const dejson_record_meta_t* get() { return &g_Meta/*= aggregate.id */; }
+};
+
+template<> struct dejson::view_of<::/*= aggregate.id */> {
+  typedef /*= args.namespace */::/*= aggregate.id */ type;
+};
+/*! end */
+
+#endif /* /*= args.hppGuard */ */
+]]
+
 local code = [[
 #include "/*= args.include */"
 
+/*! for _, enum in ipairs(args.ast.enums) do */
+static const dejson_enum_value_meta_t s_slotMeta/*= enum.id */[] = {
+/*!   for _, value in ipairs(enum.slots) do */
+/*!     if value.id then */
+  { /*= value.cname */, /*= string.format('0x%08xU', value.hash) */, /*= #value.name */, /*= enum.id */_/*= value.id */ },
+/*!     else */
+  { NULL, 0x00000000U, 0, 0 },
+/*!     end */
+/*!   end */
+};
+
+static const char* const s_names/*= enum.id */[] = {
+/*!   for _, value in ipairs(enum.values) do */
+  /*= value.cname */,
+/*!   end */
+};
+
+const dejson_enum_meta_t g_Meta/*= enum.id */ = {
+  /* slots      */ s_slotMeta/*= enum.id */,
+  /* names      */ s_names/*= enum.id */,
+  /* name_hash  */ /*= string.format('0x%08xU', enum.hash) */,
+  /* multiplier */ /*= string.format('0x%08xU', enum.multiplier) */,
+  /* mask       */ /*= string.format('0x%08xU', enum.mask) */,
+  /* count      */ /*= #enum.values */,
+  /* shift      */ /*= enum.shift */,
+  /* size       */ /*= enum.size */
+};
+
+/*! end */
 /*! for _, aggregate in ipairs(args.ast) do */
 static const dejson_record_field_meta_t s_fieldMeta/*= aggregate.id */[] = {
 /*!   for _, field in ipairs(aggregate.fields) do */
   { /* /*= field.decl */ */
     /* name_hash */ /*= string.format('0x%08xU', field.hash) */,
-    /* type_hash */ /*= string.format('0x%08xU', field.dejson == 'DEJSON_TYPE_RECORD' and field.type.hash or 0) */,
+    /* type_hash */ /*= string.format('0x%08xU', field.typeHash) */,
+    /* key_hash  */ /*= string.format('0x%08xU', field.type.keyHash or 0) */,
     /* offset    */ DEJSON_OFFSETOF(/*= aggregate.id */, /*= field.id */),
     /* type      */ /*= field.dejson */,
-    /* flags     */ /*= field.type.isArray and 'DEJSON_FLAG_ARRAY' or (field.type.isPointer and 'DEJSON_FLAG_POINTER' or 0) */
+    /* flags     */ /*= field.flags */,
+    /* presence  */ /*= field.bit or 0 */
   },
 /*!   end */
 };
@@ -381,9 +940,20 @@ const dejson_record_meta_t g_Meta/*= aggregate.id */ = {
   /* fields     */ s_fieldMeta/*= aggregate.id */,
   /* name_hash  */ /*= string.format('0x%08xU', aggregate.hash) */,
   /* size       */ sizeof(/*= aggregate.id */),
+/*!   if aggregate.optionals ~= 0 then */
+  /* presence   */ DEJSON_OFFSETOF(/*= aggregate.id */, dejson_presence),
+/*!   else */
+  /* presence   */ 0,
+/*!   end */
   /* alignment  */ DEJSON_ALIGNOF(/*= aggregate.id */),
   /* num_fields */ /*= #aggregate.fields */
 };
+/*!   for _, finder in ipairs(aggregate.finders) do */
+
+const /*= aggregate.id */* /*= aggregate.id */_find_by_/*= finder.id */(const dejson_indexed_array_t* array, /*= finder.decl */) {
+  return (const /*= aggregate.id */*)dejson_index_find(array, (const void*)&/*= finder.id */);
+}
+/*!   end */
 /*! end */
 
 const dejson_record_meta_t* dejson_resolve_record(uint32_t hash) {
@@ -394,6 +964,24 @@ const dejson_record_meta_t* dejson_resolve_record(uint32_t hash) {
     default: return NULL;
   }
 }
+
+const dejson_enum_meta_t* dejson_resolve_enum(uint32_t hash) {
+  switch (hash) {
+/*! for _, enum in ipairs(args.ast.enums) do */
+    case /*= string.format('0x%08xU', enum.hash) */: return &g_Meta/*= enum.id */;
+/*! end */
+    default: return NULL;
+  }
+}
+
+dejson_converter_t dejson_resolve_converter(uint32_t hash) {
+  switch (hash) {
+/*! for _, converter in ipairs(args.ast.converters) do */
+    case /*= string.format('0x%08xU', converter.hash) */: return /*= converter.id */;
+/*! end */
+    default: return NULL;
+  }
+}
 ]]
 
 local function generate(options, template, out)
@@ -410,6 +998,7 @@ end
 return function(args)
   local genc = false
   local genh = false
+  local genp = false
   local inputs = {}
 
   for i = 2, #args do
@@ -417,6 +1006,8 @@ return function(args)
       genc = true
     elseif args[i] == '-h' then
       genh = true
+    elseif args[i] == '-p' then
+      genp = true
     else
       inputs[#inputs + 1] = args[i]
     end
@@ -426,7 +1017,7 @@ return function(args)
     error('missing input file\n')
   end
 
-  if not (genh or genc) then
+  if not (genh or genc or genp) then
     error('nothing to generate')
   end
 
@@ -438,7 +1029,9 @@ return function(args)
       ast = ast,
       include = ddlt.join(nil, name, 'h'),
       file = ddlt.realpath(inputs[i]),
-      guard = '__' .. ddlt.join(nil, name, 'h'):gsub('[^%w%d]', '_'):upper() .. '__'
+      guard = '__' .. ddlt.join(nil, name, 'h'):gsub('[^%w%d]', '_'):upper() .. '__',
+      hppGuard = '__' .. ddlt.join(nil, name, 'hpp'):gsub('[^%w%d]', '_'):upper() .. '__',
+      namespace = name:gsub('[^%w%d]', '_')
     }
 
     if genh then
@@ -448,5 +1041,10 @@ return function(args)
     if genc then
       generate(options, code, ddlt.join(nil, name, 'c'))
     end
+
+    if genp then
+      cpp(ast, options.namespace)
+      generate(options, wrapper, ddlt.join(nil, name, 'hpp'))
+    end
   end
 end
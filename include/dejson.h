@@ -11,6 +11,15 @@ extern "C" {
 #define DEJSON_OFFSETOF(s, f) ((size_t)(&((s*)0)->f))
 #define DEJSON_ALIGNOF(t)     DEJSON_OFFSETOF(struct{char c; t d;}, d)
 
+/*
+Objects and arrays nested deeper than this fail with DEJSON_TOO_DEEP, so that
+the parser's recursion is bounded whatever the input, which matters when it
+runs on a small stack like the coroutines in dejson.hpp do.
+*/
+#ifndef DEJSON_MAX_DEPTH
+#define DEJSON_MAX_DEPTH 256
+#endif
+
 enum
 {
   DEJSON_OK,
@@ -24,7 +33,14 @@ enum
   DEJSON_INVALID_VALUE,
   DEJSON_UNTERMINATED_STRING,
   DEJSON_UNTERMINATED_ARRAY,
-  DEJSON_INVALID_ESCAPE
+  DEJSON_INVALID_ESCAPE,
+  DEJSON_INVALID_INDEX,
+  DEJSON_OUT_OF_MEMORY,
+  DEJSON_STREAM_ERROR,
+  DEJSON_UNKNOWN_ENUM,
+  DEJSON_UNKNOWN_CONVERTER,
+  DEJSON_INVALID_UTF8,
+  DEJSON_TOO_DEEP
 };
 
 enum
@@ -49,13 +65,21 @@ enum
   DEJSON_TYPE_DOUBLE,
   DEJSON_TYPE_BOOL,
   DEJSON_TYPE_STRING,
-  DEJSON_TYPE_RECORD
+  DEJSON_TYPE_RECORD,
+  DEJSON_TYPE_ENUM,
+  DEJSON_TYPE_JSON,
+  DEJSON_TYPE_BYTES
 };
 
 enum
 {
-  DEJSON_FLAG_ARRAY   = 1 << 0,
-  DEJSON_FLAG_POINTER = 1 << 1
+  DEJSON_FLAG_ARRAY     = 1 << 0,
+  DEJSON_FLAG_POINTER   = 1 << 1,
+  DEJSON_FLAG_MAP       = 1 << 2,
+  DEJSON_FLAG_INDEXED   = 1 << 3,
+  DEJSON_FLAG_QUOTED    = 1 << 4,
+  DEJSON_FLAG_CONVERTED = 1 << 5,
+  DEJSON_FLAG_OPTIONAL  = 1 << 6
 };
 
 typedef struct
@@ -64,6 +88,30 @@ typedef struct
 }
 dejson_string_t;
 
+/*
+The raw text of a value of any type, exactly as it appears in the input. chars
+points into the input, which must outlive the deserialized data, and isn't
+NUL-terminated. dejson_deserialize_json and dejson_get_json_size deserialize
+spans of objects against a record later on. They parse a NUL-terminated copy of
+the span, kept in the buffer after the root record, so json fields in the
+result point into the copy. dejson_get_json_size mallocs a temporary copy and
+can fail with DEJSON_OUT_OF_MEMORY.
+*/
+typedef struct
+{
+  const char* chars;
+  uint32_t    length;
+}
+dejson_json_t;
+
+/* Binary data, decoded from base64 strings into the buffer */
+typedef struct
+{
+  const uint8_t* data;
+  uint32_t       length;
+}
+dejson_bytes_t;
+
 typedef struct
 {
   void*    elements;
@@ -75,13 +123,81 @@ dejson_array_t;
 #define DEJSON_GET_ELEMENT(array, ndx) \
   ((void*)((uint8_t*)(array).elements + ndx * (array).element_size))
 
+/*
+Starts just like dejson_array_t, so DEJSON_GET_ELEMENT works on it. slots is
+an open-addressing table with capacity (a power of two) entries, each holding
+zero for empty or an element index + 1, keyed by the field at key_offset.
+*/
+typedef struct
+{
+  void*     elements;
+  uint32_t  count;
+  uint32_t  element_size;
+  uint32_t* slots;
+  uint32_t  capacity;
+  uint32_t  key_offset;
+  uint8_t   key_type;
+}
+dejson_indexed_array_t;
+
+typedef struct
+{
+  dejson_string_t key;
+  uint32_t        hash;
+  uint32_t        length;
+}
+dejson_map_entry_t;
+
+/*
+Entries are stored densely in key order of appearance, each one followed by
+its value at value_offset, with room for room entries before the map has to
+grow. slots is an open-addressing table with capacity (a power of two) entries,
+each holding zero for empty or an entry index + 1. Patches append new keys,
+and move the last entry in place of each removed one.
+*/
+typedef struct
+{
+  void*     entries;
+  uint32_t* slots;
+  uint32_t  count;
+  uint32_t  capacity;
+  uint32_t  entry_size;
+  uint32_t  value_offset;
+  uint32_t  room;
+}
+dejson_map_t;
+
+#define DEJSON_GET_ENTRY(map, ndx) \
+  ((dejson_map_entry_t*)((uint8_t*)(map).entries + ndx * (map).entry_size))
+
+#define DEJSON_GET_VALUE(map, ndx) \
+  ((void*)((uint8_t*)(map).entries + ndx * (map).entry_size + (map).value_offset))
+
+/*
+Records with optional fields end with a dejson_presence bitmap, and the
+compiler generates a Record_Field_BIT constant with the first of the two bits
+of each optional field. Fields that aren't in the object have neither bit set,
+and are zeroed just like fields that are null.
+*/
+#define DEJSON_IS_PRESENT(record, bit) \
+  (((record).dejson_presence[(bit) >> 3] >> ((bit) & 7)) & 1)
+
+#define DEJSON_IS_NULL(record, bit) \
+  (((record).dejson_presence[(bit) >> 3] >> (((bit) & 7) + 1)) & 1)
+
+/*
+presence is the bit of optional fields in the record's presence bitmap, which
+starts at the record's presence offset.
+*/
 typedef struct
 {
   uint32_t name_hash;
   uint32_t type_hash;
+  uint32_t key_hash;
   uint32_t offset;
   uint8_t  type;
   uint8_t  flags;
+  uint16_t presence;
 }
 dejson_record_field_meta_t;
 
@@ -91,17 +207,116 @@ typedef struct
 
   uint32_t name_hash;
   uint32_t size;
+  uint32_t presence;
   uint16_t alignment;
   uint8_t  num_fields;
 }
 dejson_record_meta_t;
 
+/*
+Converters turn string values into fields of any scalar type as they're
+parsed. chars has the length bytes between the quotes, with escapes left as
+they are, and the converter must return zero if they aren't valid. They're
+called in both passes, and must only write sizeof the field type to value.
+*/
+typedef int (*dejson_converter_t)(void* value, const char* chars, size_t length);
+
+typedef struct
+{
+  const char* name;
+  uint32_t    hash;
+  uint32_t    length;
+  uint32_t    value;
+}
+dejson_enum_value_meta_t;
+
+/*
+Enumerations are matched with a perfect hash computed by the compiler: the
+value whose name hashes to h can only be at
+slots[((h * multiplier) >> shift) & mask], and empty slots have a NULL name.
+Values start at one, zero is stored for names that aren't in the enumeration.
+names has the count names in value order. Values are stored inline with size
+bytes, which is 1, 2 or 4.
+*/
+typedef struct
+{
+  const dejson_enum_value_meta_t* slots;
+  const char* const*              names;
+
+  uint32_t name_hash;
+  uint32_t multiplier;
+  uint32_t mask;
+  uint32_t count;
+  uint8_t  shift;
+  uint8_t  size;
+}
+dejson_enum_meta_t;
+
+/*
+Lets the counting pass run while the input is still arriving. When the parser
+reaches a NUL, more is called with its position and must return non-zero after
+making more input available there, or zero at the end of the input. Input must
+only be made available up to a point right after a space, a structural
+character, or a closing quote, so that tokens are never split.
+dejson_feed_cut finds such a point in json[begin, end), keeping the string
+state across calls in in_string, and returns cut if there's none.
+*/
+typedef struct dejson_feed_t dejson_feed_t;
+
+struct dejson_feed_t
+{
+  int (*more)(dejson_feed_t* feed, const uint8_t* json);
+};
+
+/*
+dejson_foreach calls callback for each element of the arrays of records at
+path, deserialized one at a time into scratch, which must have room for the
+largest element. path has the keys from the root object to the array
+separated by dots, i.e. "PatchData.Achievements", or is empty for a root
+array, and there are no elements if it's missing or null. callback gets the
+element's zero-based index, and returns zero to stop the walk early. Elements
+are passed on as they're parsed, before the rest of the document is checked.
+dejson_foreach_feed takes a feed like dejson_get_size_feed, so that elements
+are passed on while the rest of the input is still arriving.
+*/
+typedef int (*dejson_element_t)(void* userdata, void* element, size_t index);
+
+/*
+dejson_validate checks json against the record without writing anything, and
+returns the same error dejson_get_size would. json must have a NUL at length,
+and a NUL before that is reported as DEJSON_EOF_EXPECTED. In all functions,
+strings and keys must be valid UTF-8, or DEJSON_INVALID_UTF8 is returned.
+
+dejson_apply_patch changes root as it goes, so if it fails root is left with
+part of the patch applied and must be discarded. It only fails where
+dejson_get_patch_size would, or with DEJSON_OUT_OF_MEMORY if size is less than
+what dejson_get_patch_size returned for the same root and patch, which is the
+exact size needed. When a key is repeated in an object, only its last value is
+applied.
+*/
 int      dejson_deserialize(void* buffer, uint32_t hash, const uint8_t* json);
 int      dejson_get_size(size_t* size, uint32_t hash, const uint8_t* json);
+int      dejson_validate(uint32_t hash, const uint8_t* json, size_t length);
+int      dejson_deserialize_feed(void* buffer, uint32_t hash, const uint8_t* json, dejson_feed_t* feed);
+int      dejson_get_size_feed(size_t* size, uint32_t hash, const uint8_t* json, dejson_feed_t* feed);
+int      dejson_deserialize_record(void* buffer, const dejson_record_meta_t* meta, const uint8_t* json, dejson_feed_t* feed);
+int      dejson_get_record_size(size_t* size, const dejson_record_meta_t* meta, const uint8_t* json, dejson_feed_t* feed);
+int      dejson_deserialize_json(void* buffer, const dejson_record_meta_t* meta, const dejson_json_t* json);
+int      dejson_get_json_size(size_t* size, const dejson_record_meta_t* meta, const dejson_json_t* json);
+int      dejson_foreach(void* scratch, size_t size, uint32_t hash, const uint8_t* json, const char* path, dejson_element_t callback, void* userdata);
+int      dejson_foreach_feed(void* scratch, size_t size, uint32_t hash, const uint8_t* json, const char* path, dejson_element_t callback, void* userdata, dejson_feed_t* feed);
+size_t   dejson_feed_cut(const uint8_t* json, size_t begin, size_t end, size_t cut, int* in_string);
+int      dejson_apply_patch(void* root, void* overflow, size_t size, uint32_t hash, const uint8_t* patch);
+int      dejson_get_patch_size(size_t* size, const void* root, uint32_t hash, const uint8_t* patch);
 uint32_t dejson_hash(const uint8_t* str, size_t length);
+void*    dejson_map_find(const dejson_map_t* map, const char* key, size_t length);
+void*    dejson_index_find(const dejson_indexed_array_t* array, const void* key);
+const char* dejson_enum_name(const dejson_enum_meta_t* meta, uint32_t value);
 
-/* User-defined resolver function */
+/* User-defined resolver functions */
 const dejson_record_meta_t* dejson_resolve_record(uint32_t hash);
+const dejson_enum_meta_t*   dejson_resolve_enum(uint32_t hash);
+dejson_converter_t          dejson_resolve_converter(uint32_t hash);
 
 #ifdef __cplusplus
 }
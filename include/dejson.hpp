@@ -0,0 +1,686 @@
+#ifndef __DEJSON_HPP__
+#define __DEJSON_HPP__
+
+#include <dejson.h>
+
+#include <iterator>
+#include <memory>
+#include <optional>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#ifdef __cpp_impl_coroutine
+#include <coroutine>
+#include <exception>
+#include <vector>
+
+#include <sys/mman.h>
+#include <ucontext.h>
+#include <unistd.h>
+#endif
+
+/*
+C++ layer over the C API.
+
+The compiler's -p option generates a header with a view class for each
+structure, in a namespace named after the schema. Views are a pointer to the
+deserialized structure, with typed accessors returning std::string_view for
+strings, json and bytes fields, array_view and map_view for arrays and maps,
+std::optional for pointers and optional fields, the C enumeration for
+enumerations, and views for nested structures. Optional fields also get a
+<Field>_is_null accessor. Views also carry their schema metadata as constexpr
+members, and specialize meta_of and view_of so that deserialize<T> can pick the
+record metadata at compile time, and name_of can turn enumeration values back
+into strings:
+
+  dejson::document<Patch> patch = dejson::deserialize<Patch>(json);
+  RetroAchievements::Patch view = patch.view();
+
+The std::string_view of a json field, or of any object alone, can be deserialized
+later on the same way. The view is copied into the document, so it needn't be
+NUL-terminated or outlive it.
+
+With C++20 coroutines, documents can also be deserialized asynchronously:
+
+  dejson::document<Patch> patch = co_await dejson::parse<Patch>(source, capacity);
+
+source is any object with a read(void* data, size_t size) method returning an
+awaitable that resumes with the number of bytes written to data, or zero at
+the end of the input. If it also has a yield() method returning an awaitable,
+that awaitable is co_awaited after each chunk of work, so that parsing large
+documents doesn't starve other tasks running on the same thread.
+
+The C parser runs on its own stack on the calling thread, and is suspended
+whenever it needs more input. capacity is the maximum size of the document,
+which is kept in full until the parse ends, and then by the document if
+parsing succeeds, since json fields point into it.
+
+The stack is mapped with a guard page below it, so an overflow faults instead
+of writing over the heap, and DEJSON_MAX_DEPTH bounds the parser's recursion
+so that the default stack_size is enough for any input; raise stack_size along
+with DEJSON_MAX_DEPTH. Switching stacks uses ucontext, which POSIX.1-2008
+removed but glibc and the BSDs still provide, and swapcontext saves and
+restores the signal mask with a system call on every switch, so there are two
+of them for each chunk read or yielded. chunk should be large enough for that
+to be lost in the parsing.
+
+Structures without a generated C++ header can be mapped to their metadata with
+DEJSON_META(Patch) at global scope, after including the generated C header.
+*/
+
+#define DEJSON_META(T) \
+  template<> struct dejson::meta_of<T> { static constexpr const dejson_record_meta_t* get() { return &g_Meta ## T; } }
+
+namespace dejson
+{
+  template<typename T>
+  struct meta_of;
+
+  template<typename T>
+  struct view_of;
+
+  struct field_info
+  {
+    const char* name;
+    uint32_t    name_hash;
+    uint32_t    type_hash;
+    size_t      offset;
+    uint8_t     type;
+    uint8_t     flags;
+    uint16_t    presence;
+  };
+
+  namespace detail
+  {
+    template<typename T, typename Stored>
+    inline T convert(const Stored& stored)
+    {
+      if constexpr (std::is_same<Stored, dejson_json_t>::value)
+      {
+        return std::string_view(stored.chars, stored.length);
+      }
+      else if constexpr (std::is_same<Stored, dejson_bytes_t>::value)
+      {
+        return std::string_view((const char*)stored.data, stored.length);
+      }
+      else if constexpr (std::is_same<T, std::string_view>::value)
+      {
+        return std::string_view(stored.chars);
+      }
+      else if constexpr (std::is_same<T, bool>::value)
+      {
+        return stored != 0;
+      }
+      else
+      {
+        return T(stored);
+      }
+    }
+
+    template<typename T, typename Stored>
+    inline std::optional<T> convert_pointer(const Stored* stored)
+    {
+      if (stored == NULL)
+      {
+        return std::nullopt;
+      }
+
+      return convert<T>(*stored);
+    }
+  }
+
+  /* Works on both dejson_array_t and dejson_indexed_array_t, with the element size known at compile time */
+  template<typename T, typename Stored = T>
+  class array_view
+  {
+  public:
+    class iterator
+    {
+    public:
+      typedef std::random_access_iterator_tag iterator_category;
+      typedef T                               value_type;
+      typedef ptrdiff_t                       difference_type;
+      typedef void                            pointer;
+      typedef T                               reference;
+
+      explicit iterator(const Stored* element) : element_(element) {}
+
+      T operator*() const { return detail::convert<T>(*element_); }
+      T operator[](difference_type ndx) const { return detail::convert<T>(element_[ndx]); }
+
+      iterator& operator++() { ++element_; return *this; }
+      iterator operator++(int) { return iterator(element_++); }
+      iterator& operator--() { --element_; return *this; }
+      iterator operator--(int) { return iterator(element_--); }
+      iterator& operator+=(difference_type count) { element_ += count; return *this; }
+      iterator& operator-=(difference_type count) { element_ -= count; return *this; }
+      iterator operator+(difference_type count) const { return iterator(element_ + count); }
+      iterator operator-(difference_type count) const { return iterator(element_ - count); }
+      difference_type operator-(const iterator& other) const { return element_ - other.element_; }
+
+      bool operator==(const iterator& other) const { return element_ == other.element_; }
+      bool operator!=(const iterator& other) const { return element_ != other.element_; }
+      bool operator<(const iterator& other) const { return element_ < other.element_; }
+
+    private:
+      const Stored* element_;
+    };
+
+    template<typename A>
+    explicit array_view(const A& array) : elements_(static_cast<const Stored*>(array.elements)), count_(array.count) {}
+
+    size_t size() const { return count_; }
+    bool empty() const { return count_ == 0; }
+    const Stored* data() const { return elements_; }
+
+    T operator[](size_t ndx) const { return detail::convert<T>(elements_[ndx]); }
+    T front() const { return detail::convert<T>(elements_[0]); }
+    T back() const { return detail::convert<T>(elements_[count_ - 1]); }
+
+    iterator begin() const { return iterator(elements_); }
+    iterator end() const { return iterator(elements_ + count_); }
+
+  private:
+    const Stored* elements_;
+    size_t        count_;
+  };
+
+  template<typename T, typename Stored = T>
+  class map_view
+  {
+  public:
+    explicit map_view(const dejson_map_t& map) : map_(&map) {}
+
+    size_t size() const { return map_->count; }
+    bool empty() const { return map_->count == 0; }
+
+    /* Entries in order of appearance */
+    std::string_view key(size_t ndx) const
+    {
+      const dejson_map_entry_t* entry = DEJSON_GET_ENTRY(*map_, ndx);
+      return std::string_view(entry->key.chars, entry->length);
+    }
+
+    T value(size_t ndx) const
+    {
+      return detail::convert<T>(*static_cast<const Stored*>(DEJSON_GET_VALUE(*map_, ndx)));
+    }
+
+    std::optional<T> find(std::string_view key) const
+    {
+      return detail::convert_pointer<T>(static_cast<const Stored*>(dejson_map_find(map_, key.data(), key.size())));
+    }
+
+  private:
+    const dejson_map_t* map_;
+  };
+
+  /* Empty for values that weren't in the enumeration */
+  template<typename T>
+  inline std::string_view name_of(T value)
+  {
+    const char* name = dejson_enum_name(meta_of<T>::get(), value);
+    return name != NULL ? std::string_view(name) : std::string_view();
+  }
+
+  template<typename T>
+  class document
+  {
+  public:
+    explicit document(int error) : error_(error) {}
+    explicit document(void* buffer, void* input = NULL) : error_(DEJSON_OK), buffer_(buffer), input_(input) {}
+
+    int error() const { return error_; }
+    explicit operator bool() const { return error_ == DEJSON_OK; }
+
+    const T* get() const { return static_cast<const T*>(buffer_.get()); }
+    const T* operator->() const { return get(); }
+    const T& operator*() const { return *get(); }
+
+    /* Needs the header generated with -p */
+    template<typename U = T>
+    typename view_of<U>::type view() const { return typename view_of<U>::type(*get()); }
+
+  private:
+    struct deleter
+    {
+      void operator()(void* buffer) const { free(buffer); }
+    };
+
+    int error_;
+    std::unique_ptr<void, deleter> buffer_;
+    std::unique_ptr<void, deleter> input_;
+  };
+
+  template<typename T>
+  inline int get_size(size_t* size, const uint8_t* json)
+  {
+    return dejson_get_record_size(size, meta_of<T>::get(), json, NULL);
+  }
+
+  template<typename T>
+  inline int deserialize(void* buffer, const uint8_t* json)
+  {
+    return dejson_deserialize_record(buffer, meta_of<T>::get(), json, NULL);
+  }
+
+  /* json is the text of an object alone, like the value of a json field */
+  template<typename T>
+  inline int get_size(size_t* size, std::string_view json)
+  {
+    dejson_json_t span = {json.data(), (uint32_t)json.size()};
+    return dejson_get_json_size(size, meta_of<T>::get(), &span);
+  }
+
+  template<typename T>
+  inline int deserialize(void* buffer, std::string_view json)
+  {
+    dejson_json_t span = {json.data(), (uint32_t)json.size()};
+    return dejson_deserialize_json(buffer, meta_of<T>::get(), &span);
+  }
+
+  namespace detail
+  {
+    template<typename T, typename Json>
+    document<T> deserialize(Json json)
+    {
+      size_t size;
+      int res = dejson::get_size<T>(&size, json);
+
+      if (res != DEJSON_OK)
+      {
+        return document<T>(res);
+      }
+
+      void* buffer = malloc(size);
+
+      if (buffer == NULL)
+      {
+        return document<T>(DEJSON_OUT_OF_MEMORY);
+      }
+
+      document<T> result(buffer);
+      res = dejson::deserialize<T>(buffer, json);
+      return res == DEJSON_OK ? std::move(result) : document<T>(res);
+    }
+  }
+
+  template<typename T>
+  document<T> deserialize(const uint8_t* json)
+  {
+    return detail::deserialize<T>(json);
+  }
+
+  template<typename T>
+  document<T> deserialize(std::string_view json)
+  {
+    return detail::deserialize<T>(json);
+  }
+
+  /* f is called as f(const T& element, size_t index) and returns false to stop, it must not throw */
+  template<typename T, typename F>
+  inline int foreach(void* scratch, size_t size, const uint8_t* json, const char* path, F&& f, dejson_feed_t* feed = NULL)
+  {
+    typedef typename std::remove_reference<F>::type function;
+
+    dejson_element_t callback = [](void* userdata, void* element, size_t index) -> int {
+      return (*static_cast<function*>(userdata))(*static_cast<const T*>(element), index) ? 1 : 0;
+    };
+
+    return dejson_foreach_feed(scratch, size, meta_of<T>::get()->name_hash, json, path, callback, (void*)&f, feed);
+  }
+
+#ifdef __cpp_impl_coroutine
+  template<typename T>
+  class task
+  {
+  public:
+    struct promise_type
+    {
+      std::optional<T> value;
+      std::exception_ptr exception;
+      std::coroutine_handle<> continuation;
+
+      struct final_awaiter
+      {
+        bool await_ready() const noexcept { return false; }
+        void await_resume() const noexcept {}
+
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> handle) const noexcept
+        {
+          std::coroutine_handle<> continuation = handle.promise().continuation;
+          return continuation ? continuation : std::noop_coroutine();
+        }
+      };
+
+      task get_return_object() { return task(std::coroutine_handle<promise_type>::from_promise(*this)); }
+      std::suspend_always initial_suspend() const noexcept { return {}; }
+      final_awaiter final_suspend() const noexcept { return {}; }
+      void return_value(T result) { value.emplace(std::move(result)); }
+      void unhandled_exception() { exception = std::current_exception(); }
+    };
+
+    task(task&& other) noexcept : handle_(std::exchange(other.handle_, {})) {}
+    task(const task&) = delete;
+
+    ~task()
+    {
+      if (handle_)
+      {
+        handle_.destroy();
+      }
+    }
+
+    bool await_ready() const noexcept { return false; }
+
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> continuation) noexcept
+    {
+      handle_.promise().continuation = continuation;
+      return handle_;
+    }
+
+    T await_resume()
+    {
+      promise_type& promise = handle_.promise();
+
+      if (promise.exception)
+      {
+        std::rethrow_exception(promise.exception);
+      }
+
+      return std::move(*promise.value);
+    }
+
+  private:
+    explicit task(std::coroutine_handle<promise_type> handle) : handle_(handle) {}
+
+    std::coroutine_handle<promise_type> handle_;
+  };
+
+  namespace detail
+  {
+    class parser : public dejson_feed_t
+    {
+    public:
+      enum request_t
+      {
+        READ,
+        YIELD,
+        DONE
+      };
+
+      parser(const dejson_record_meta_t* meta, size_t capacity, size_t chunk, size_t stack_size)
+        : meta_(meta), capacity_(capacity), chunk_(chunk), length_(0), cut_(0), held_(0), in_string_(0)
+        , eof_(false), overflow_(false), counting_(true), next_(0), buffer_(NULL), error_(DEJSON_OK)
+        , json_((uint8_t*)malloc(capacity + 1)), stack_(MAP_FAILED)
+      {
+        more = feed;
+
+        /* The stack grows down into the guard page at the bottom of the mapping */
+        page_ = (size_t)sysconf(_SC_PAGESIZE);
+        stack_size_ = (stack_size + page_ - 1) / page_ * page_ + page_;
+        stack_ = mmap(NULL, stack_size_, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+        if (stack_ != MAP_FAILED && mprotect(stack_, page_, PROT_NONE) != 0)
+        {
+          munmap(stack_, stack_size_);
+          stack_ = MAP_FAILED;
+        }
+
+        if (json_ == NULL || stack_ == MAP_FAILED)
+        {
+          return;
+        }
+
+        json_[0] = 0;
+
+        getcontext(&fiber_);
+        fiber_.uc_stack.ss_sp = (void*)((char*)stack_ + page_);
+        fiber_.uc_stack.ss_size = stack_size_ - page_;
+        fiber_.uc_link = &caller_;
+
+        /* makecontext only passes ints along */
+        uintptr_t self = (uintptr_t)this;
+        makecontext(&fiber_, (void (*)())entry, 2, (unsigned)self, (unsigned)((uint64_t)self >> 32));
+      }
+
+      ~parser()
+      {
+        if (stack_ != MAP_FAILED)
+        {
+          munmap(stack_, stack_size_);
+        }
+
+        free((void*)json_);
+        free(buffer_);
+      }
+
+      bool valid() const { return json_ != NULL && stack_ != MAP_FAILED; }
+
+      /* Runs the parser until it needs something from the coroutine */
+      request_t resume()
+      {
+        swapcontext(&caller_, &fiber_);
+        return request_;
+      }
+
+      uint8_t* data() const { return json_ + length_; }
+      size_t room() const { return capacity_ - length_; }
+
+      void received(size_t length)
+      {
+        if (length == 0)
+        {
+          eof_ = true;
+          return;
+        }
+
+        cut_ = dejson_feed_cut(json_, length_, length_ + length, cut_, &in_string_);
+        length_ += length;
+        json_[length_] = 0;
+
+        /* Spots where the second pass will yield */
+        if (cut_ - (cuts_.empty() ? 0 : cuts_.back()) >= chunk_)
+        {
+          cuts_.push_back(cut_);
+        }
+      }
+
+      void overflow()
+      {
+        overflow_ = eof_ = true;
+      }
+
+      template<typename T>
+      document<T> result()
+      {
+        if (error_ != DEJSON_OK)
+        {
+          return document<T>(error_);
+        }
+
+        return document<T>(std::exchange(buffer_, nullptr), (void*)std::exchange(json_, nullptr));
+      }
+
+    private:
+      static void entry(unsigned low, unsigned high)
+      {
+        ((parser*)(uintptr_t)(((uint64_t)high << 32) | low))->run();
+      }
+
+      static int feed(dejson_feed_t* feed, const uint8_t* json)
+      {
+        return static_cast<parser*>(feed)->more_input(json);
+      }
+
+      void run()
+      {
+        size_t size;
+        error_ = dejson_get_record_size(&size, meta_, json_, this);
+
+        if (overflow_)
+        {
+          error_ = DEJSON_OUT_OF_MEMORY;
+        }
+
+        if (error_ == DEJSON_OK)
+        {
+          buffer_ = malloc(size);
+
+          if (buffer_ == NULL)
+          {
+            error_ = DEJSON_OUT_OF_MEMORY;
+          }
+          else
+          {
+            /* Start over, yielding at the spots recorded in the first pass */
+            json_[cut_] = held_;
+            cut_ = 0;
+            held_ = json_[0];
+            json_[0] = 0;
+            counting_ = false;
+
+            error_ = dejson_deserialize_record(buffer_, meta_, json_, this);
+          }
+        }
+
+        request_ = DONE;
+      }
+
+      void suspend(request_t request)
+      {
+        request_ = request;
+        swapcontext(&fiber_, &caller_);
+      }
+
+      int more_input(const uint8_t* json)
+      {
+        size_t pos = json - json_;
+
+        if (pos < cut_)
+        {
+          /* A NUL in the document itself */
+          return 0;
+        }
+
+        json_[cut_] = held_;
+
+        if (counting_)
+        {
+          while (cut_ <= pos && !eof_)
+          {
+            suspend(READ);
+          }
+
+          if (cut_ <= pos)
+          {
+            /* End of the input, whatever is left goes to the parser */
+            cut_ = length_;
+          }
+        }
+        else
+        {
+          while (cut_ <= pos && next_ < cuts_.size())
+          {
+            cut_ = cuts_[next_++];
+          }
+
+          if (cut_ <= pos)
+          {
+            cut_ = length_;
+          }
+
+          if (cut_ > pos)
+          {
+            suspend(YIELD);
+          }
+        }
+
+        held_ = json_[cut_];
+        json_[cut_] = 0;
+        return cut_ > pos;
+      }
+
+      const dejson_record_meta_t* meta_;
+      size_t capacity_;
+      size_t chunk_;
+      size_t length_;
+      size_t cut_;
+      uint8_t held_;
+      int in_string_;
+      bool eof_;
+      bool overflow_;
+      bool counting_;
+      std::vector<size_t> cuts_;
+      size_t next_;
+      void* buffer_;
+      int error_;
+      request_t request_;
+      uint8_t* json_;
+      void* stack_;
+      size_t stack_size_;
+      size_t page_;
+      ucontext_t fiber_;
+      ucontext_t caller_;
+    };
+  }
+
+  template<typename T, typename Source>
+  task<document<T>> parse(Source& source, size_t capacity, size_t chunk = 65536, size_t stack_size = 262144)
+  {
+    detail::parser parser(meta_of<T>::get(), capacity, chunk, stack_size);
+
+    if (!parser.valid())
+    {
+      co_return document<T>(DEJSON_OUT_OF_MEMORY);
+    }
+
+    size_t unyielded = 0;
+
+    for (;;)
+    {
+      detail::parser::request_t request = parser.resume();
+
+      if (request == detail::parser::DONE)
+      {
+        co_return parser.result<T>();
+      }
+
+      if (request == detail::parser::READ)
+      {
+        size_t room = parser.room();
+
+        if (room == 0)
+        {
+          /* Only an error if there's more input */
+          uint8_t extra;
+          size_t length = co_await source.read((void*)&extra, 1);
+          length == 0 ? parser.received(0) : parser.overflow();
+          continue;
+        }
+
+        size_t length = co_await source.read((void*)parser.data(), room < chunk ? room : chunk);
+        parser.received(length);
+
+        if ((unyielded += length) < chunk)
+        {
+          continue;
+        }
+
+        unyielded = 0;
+      }
+
+      if constexpr (requires { source.yield(); })
+      {
+        co_await source.yield();
+      }
+    }
+  }
+#endif
+}
+
+#endif /* __DEJSON_HPP__ */
@@ -0,0 +1,50 @@
+#ifndef __DEJSON_CACHE_H__
+#define __DEJSON_CACHE_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <dejson.h>
+
+typedef struct dejson_cache_t dejson_cache_t;
+
+typedef struct
+{
+  uint64_t hits;
+  uint64_t misses;
+  uint64_t evictions;
+  size_t   entries;
+  size_t   bytes;
+}
+dejson_cache_stats_t;
+
+/*
+Keeps deserialized documents so that identical inputs are only parsed once.
+Entries are keyed by a 64-bit hash of the input and the record hash, and a hit
+also compares the input with the copy kept in the entry, so it's always exact.
+
+dejson_cache_deserialize works like dejson_deserialize, but *root points to an
+arena owned by the cache that may be shared with other callers and must not be
+modified. Each successful call must be paired with a dejson_cache_release of
+the root. json fields point to the copy of the input in the arena.
+
+budget is the maximum number of bytes kept by the cache, counting the data,
+the copy of the input and the entry header. When it's exceeded the least
+recently used entries are evicted; entries still in use leave the cache at
+once but are only freed on their last release. Documents larger than the
+budget are deserialized but not kept. All functions are thread-safe, and
+misses are deserialized without holding the cache's lock. All roots must be
+released before dejson_cache_destroy.
+*/
+int  dejson_cache_create(dejson_cache_t** cache, size_t budget);
+void dejson_cache_destroy(dejson_cache_t* cache);
+int  dejson_cache_deserialize(dejson_cache_t* cache, const void** root, uint32_t hash, const uint8_t* json);
+void dejson_cache_release(dejson_cache_t* cache, const void* root);
+void dejson_cache_stats(dejson_cache_t* cache, dejson_cache_stats_t* stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __DEJSON_CACHE_H__ */
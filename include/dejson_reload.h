@@ -0,0 +1,43 @@
+#ifndef __DEJSON_RELOAD_H__
+#define __DEJSON_RELOAD_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <dejson.h>
+
+typedef struct dejson_reload_t dejson_reload_t;
+typedef struct dejson_reader_t dejson_reader_t;
+
+/*
+Shares a deserialized document between reader threads while it's reloaded.
+dejson_reload_update deserializes a new version into a fresh arena on the
+calling thread and publishes it with an atomic pointer swap, so readers never
+wait on it. The arena holds a copy of the input, so json fields stay valid.
+
+Each reader thread joins once, and then brackets its accesses with
+dejson_reload_enter, which returns the current root or NULL if nothing has
+been published yet, and dejson_reload_leave. Neither blocks nor locks, and the
+root must not be used after leaving. Old arenas are retired with the epoch at
+which they were replaced, and freed by dejson_reload_update or
+dejson_reload_collect once every reader has left or entered at a later epoch.
+
+Updates and collections are serialized with a mutex, only readers are
+lock-free. dejson_reload_join returns NULL when max_readers readers have
+already joined. All readers must quit before dejson_reload_destroy.
+*/
+int              dejson_reload_create(dejson_reload_t** reload, uint32_t hash, unsigned max_readers);
+void             dejson_reload_destroy(dejson_reload_t* reload);
+int              dejson_reload_update(dejson_reload_t* reload, const uint8_t* json);
+size_t           dejson_reload_collect(dejson_reload_t* reload);
+dejson_reader_t* dejson_reload_join(dejson_reload_t* reload);
+void             dejson_reload_quit(dejson_reader_t* reader);
+const void*      dejson_reload_enter(dejson_reader_t* reader);
+void             dejson_reload_leave(dejson_reader_t* reader);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __DEJSON_RELOAD_H__ */
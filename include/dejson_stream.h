@@ -0,0 +1,46 @@
+#ifndef __DEJSON_STREAM_H__
+#define __DEJSON_STREAM_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <dejson.h>
+
+enum
+{
+  DEJSON_STREAM_PLAIN,
+  DEJSON_STREAM_GZIP,
+  DEJSON_STREAM_ZSTD
+};
+
+/* Reads up to size bytes of input into buffer, returns 0 at the end of the input */
+typedef size_t (*dejson_read_t)(void* userdata, void* buffer, size_t size);
+
+typedef struct
+{
+  dejson_read_t read;
+  void*         userdata;
+  size_t        capacity;
+  int           format;
+}
+dejson_stream_t;
+
+/*
+Decompresses the input on a separate thread while the counting pass runs on the
+decompressed document as it arrives. capacity is the maximum length of the
+decompressed document. On success, *json points to the NUL-terminated document,
+ready to be passed to dejson_deserialize, and must be freed with free.
+
+This overlaps decompression with counting, but doesn't bound memory: a buffer
+of capacity + 1 bytes is allocated up front and the whole document is kept in
+it, since the deserialization pass needs it. Only the chunks in flight between
+the threads are bounded, to 256 KiB.
+*/
+int dejson_stream_get_size(size_t* size, uint8_t** json, uint32_t hash, const dejson_stream_t* stream);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __DEJSON_STREAM_H__ */
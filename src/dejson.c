@@ -1,6 +1,5 @@
 #include <dejson.h>
 
-#include <setjmp.h>
 #include <ctype.h>
 #include <limits.h>
 #include <string.h>
@@ -8,40 +7,144 @@
 #include <float.h>
 #include <errno.h>
 
+#if defined(__SSE2__) && defined(__GNUC__)
+#include <emmintrin.h>
+#define DEJSON_HAS_SSE2
+#endif
+
+#if defined(__GNUC__) && defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define DEJSON_HAS_SWAR
+#endif
+
+/* Validating is counting without the prescans that find the number of elements in arrays and maps */
+enum
+{
+  DEJSON_DESERIALIZING,
+  DEJSON_COUNTING,
+  DEJSON_VALIDATING
+};
+
 typedef struct
 {
   const uint8_t* json;
   uintptr_t      buffer;
+  uintptr_t      limit;
+  dejson_feed_t* feed;
   int            counting;
-  jmp_buf        rollback;
+  int            error;
+  unsigned       depth;
 }
 dejson_state_t;
 
+/* An empty input, long enough for the SSE2 and SWAR readers */
+static const uint8_t dejson_end[16];
+
+/*
+Errors are sticky: the first one is kept, and the parser is pointed at an empty
+input so that every loop ends at its next check and the parse unwinds through
+plain returns. The rest of the parse only validates, so nothing is written
+after an error, not even to memory that was allocated past the limit.
+*/
+static void dejson_fail(dejson_state_t* state, int error)
+{
+  if (state->error == DEJSON_OK)
+  {
+    state->error = error;
+  }
+
+  state->json = dejson_end;
+  state->feed = NULL;
+  state->counting = DEJSON_VALIDATING;
+}
+
 static void* dejson_alloc(dejson_state_t* state, size_t size, size_t alignment)
 {
   state->buffer = (state->buffer + alignment - 1) & ~(alignment - 1);
   void* ptr = (void*)state->buffer;
   state->buffer += size;
+
+  if (state->buffer > state->limit)
+  {
+    dejson_fail(state, DEJSON_OUT_OF_MEMORY);
+  }
+
   return ptr;
 }
 
+/* Every call that succeeds must be paired with a decrement of depth, failed parses just unwind */
+static int dejson_enter(dejson_state_t* state)
+{
+  if (++state->depth > DEJSON_MAX_DEPTH)
+  {
+    dejson_fail(state, DEJSON_TOO_DEEP);
+    return 0;
+  }
+
+  return 1;
+}
+
+/* Only the four whitespace characters in the JSON grammar, isspace depends on the locale */
+#define DEJSON_IS_SPACE(c) ((c) == ' ' || (c) == '\n' || (c) == '\r' || (c) == '\t')
+#define DEJSON_IS_DIGIT(c) ((unsigned)((c) - '0') < 10)
+
 static void dejson_skip_spaces(dejson_state_t* state)
 {
-  if (isspace(*state->json))
+  for (;;)
   {
-    do
+    const uint8_t* json = state->json;
+
+    while (DEJSON_IS_SPACE(*json))
     {
-      state->json++;
+      json++;
+    }
+
+    state->json = json;
+
+    /* With a feed, a NUL may just be the end of the input received so far */
+    if (*json != 0 || state->feed == NULL || !state->feed->more(state->feed, json))
+    {
+      return;
     }
-    while (isspace(*state->json));
   }
 }
 
 static size_t dejson_skip_string(dejson_state_t*);
 static void dejson_skip_value(dejson_state_t*);
 
-static void dejson_skip_object(dejson_state_t* state)
+static uint32_t* dejson_map_slot(const dejson_map_t* map, const char* key, size_t length, uint32_t hash)
+{
+  uint32_t mask = map->capacity - 1;
+  uint32_t ndx = (hash ^ (hash >> 16)) & mask;
+
+  for (;;)
+  {
+    uint32_t* slot = map->slots + ndx;
+
+    if (*slot == 0)
+    {
+      return slot;
+    }
+
+    const dejson_map_entry_t* entry = DEJSON_GET_ENTRY(*map, (*slot - 1));
+
+    if (entry->hash == hash && entry->length == length && memcmp(entry->key.chars, key, length) == 0)
+    {
+      return slot;
+    }
+
+    ndx = (ndx + 1) & mask;
+  }
+}
+
+static size_t dejson_skip_object(dejson_state_t* state)
 {
+  size_t count = 0;
+
+  if (!dejson_enter(state))
+  {
+    return 0;
+  }
+
   state->json++;
   dejson_skip_spaces(state);
   
@@ -52,7 +155,8 @@ static void dejson_skip_object(dejson_state_t* state)
 
     if (*state->json != ':')
     {
-      longjmp(state->rollback, DEJSON_INVALID_VALUE);
+      dejson_fail(state, DEJSON_INVALID_VALUE);
+      return 0;
     }
 
     state->json++;
@@ -60,6 +164,8 @@ static void dejson_skip_object(dejson_state_t* state)
     dejson_skip_value(state);
     dejson_skip_spaces(state);
 
+    count++;
+
     if (*state->json != ',')
     {
       break;
@@ -71,15 +177,24 @@ static void dejson_skip_object(dejson_state_t* state)
 
   if (*state->json != '}')
   {
-    longjmp(state->rollback, DEJSON_INVALID_VALUE);
+    dejson_fail(state, DEJSON_INVALID_VALUE);
+    return 0;
   }
 
+  state->depth--;
   state->json++;
+  return count;
 }
 
 static size_t dejson_skip_array(dejson_state_t* state)
 {
   size_t count = 0;
+
+  if (!dejson_enter(state))
+  {
+    return 0;
+  }
+
   state->json++;
   dejson_skip_spaces(state);
   
@@ -101,26 +216,65 @@ static size_t dejson_skip_array(dejson_state_t* state)
 
   if (*state->json != ']')
   {
-    longjmp(state->rollback, DEJSON_INVALID_VALUE);
+    dejson_fail(state, DEJSON_INVALID_VALUE);
+    return 0;
   }
 
+  state->depth--;
   state->json++;
   return count;
 }
 
+/* Only checks the syntax, values out of range are caught when they're parsed into fields */
 static void dejson_skip_number(dejson_state_t* state)
 {
-  errno = 0;
+  const uint8_t* json = state->json + (*state->json == '-');
+  const uint8_t* digits = json;
+
+  while (DEJSON_IS_DIGIT(*json))
+  {
+    json++;
+  }
+
+  /* Leading zeros aren't allowed, and neither are fractions without digits */
+  if (json == digits || (digits[0] == '0' && json - digits > 1))
+  {
+    dejson_fail(state, DEJSON_INVALID_VALUE);
+    return;
+  }
+
+  if (*json == '.')
+  {
+    json++;
+
+    if (!DEJSON_IS_DIGIT(*json))
+    {
+      dejson_fail(state, DEJSON_INVALID_VALUE);
+      return;
+    }
 
-  char* end;
-  double result = strtod((const char*)state->json, &end);
+    while (DEJSON_IS_DIGIT(*json))
+    {
+      json++;
+    }
+  }
 
-  if ((result == 0.0 && end == (const char*)state->json) || errno == ERANGE)
+  if ((*json | 0x20) == 'e')
   {
-    longjmp(state->rollback, DEJSON_INVALID_VALUE);
+    digits = json + 1 + (json[1] == '+' || json[1] == '-');
+
+    if (DEJSON_IS_DIGIT(*digits))
+    {
+      json = digits;
+
+      while (DEJSON_IS_DIGIT(*json))
+      {
+        json++;
+      }
+    }
   }
 
-  state->json = (uint8_t*)end;
+  state->json = json;
 }
 
 static void dejson_skip_boolean(dejson_state_t* state)
@@ -137,81 +291,234 @@ static void dejson_skip_boolean(dejson_state_t* state)
   }
   else
   {
-    longjmp(state->rollback, DEJSON_INVALID_VALUE);
+    dejson_fail(state, DEJSON_INVALID_VALUE);
+    return;
+  }
+}
+
+/*
+Returns the first byte at or after json that is a quote, a backslash, a NUL, or
+when high is set, a byte with its most significant bit set.
+*/
+#ifdef DEJSON_HAS_SSE2
+/* Aligned loads never cross into the next page, so reading past the NUL is safe */
+__attribute__((no_sanitize_address))
+static const uint8_t* dejson_scan_string(const uint8_t* json, int high)
+{
+  const __m128i quote = _mm_set1_epi8('"');
+  const __m128i backslash = _mm_set1_epi8('\\');
+  const __m128i zero = _mm_setzero_si128();
+
+  const uint8_t* block = (const uint8_t*)((uintptr_t)json & ~(uintptr_t)15);
+  unsigned skip = json - block;
+
+  for (;;)
+  {
+    __m128i bytes = _mm_load_si128((const __m128i*)block);
+    __m128i stops = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(bytes, quote), _mm_cmpeq_epi8(bytes, backslash)), _mm_cmpeq_epi8(bytes, zero));
+    unsigned mask = _mm_movemask_epi8(stops);
+
+    if (high)
+    {
+      mask |= _mm_movemask_epi8(bytes);
+    }
+
+    mask = (mask >> skip) << skip;
+
+    if (mask != 0)
+    {
+      return block + __builtin_ctz(mask);
+    }
+
+    block += 16;
+    skip = 0;
+  }
+}
+#else
+static const uint8_t* dejson_scan_string(const uint8_t* json, int high)
+{
+  while (*json != '"' && *json != '\\' && *json != 0 && (!high || *json < 0x80))
+  {
+    json++;
+  }
+
+  return json;
+}
+#endif
+
+/* Returns the length of the UTF-8 sequence at str, or zero if it's invalid */
+static size_t dejson_utf8_length(const uint8_t* str)
+{
+  uint8_t c = str[0];
+
+  if (c < 0x80)
+  {
+    return 1;
+  }
+  else if (c < 0xc2)
+  {
+    /* Continuation bytes and overlong two-byte sequences */
+    return 0;
+  }
+  else if (c < 0xe0)
+  {
+    return (str[1] & 0xc0) == 0x80 ? 2 : 0;
+  }
+  else if (c < 0xf0)
+  {
+    if ((str[1] & 0xc0) != 0x80 || (str[2] & 0xc0) != 0x80 || (c == 0xe0 && str[1] < 0xa0) || (c == 0xed && str[1] >= 0xa0))
+    {
+      /* Overlong sequences and surrogates */
+      return 0;
+    }
+
+    return 3;
+  }
+  else if (c < 0xf5)
+  {
+    if ((str[1] & 0xc0) != 0x80 || (str[2] & 0xc0) != 0x80 || (str[3] & 0xc0) != 0x80 || (c == 0xf0 && str[1] < 0x90) || (c == 0xf4 && str[1] >= 0x90))
+    {
+      /* Overlong sequences and code points past U+10FFFF */
+      return 0;
+    }
+
+    return 4;
+  }
+
+  return 0;
+}
+
+static uint32_t dejson_get_hex(dejson_state_t* state, const uint8_t* aux)
+{
+  uint32_t value = 0;
+  unsigned i;
+
+  for (i = 0; i < 4; i++)
+  {
+    /* Stops at a NUL, so it never reads past the end of the input */
+    if (!isxdigit(aux[i]))
+    {
+      dejson_fail(state, DEJSON_INVALID_ESCAPE);
+      return 0;
+    }
+
+    value = value * 16 + (aux[i] <= '9' ? aux[i] - '0' : (aux[i] | 0x20) - 'a' + 10);
+  }
+
+  return value;
+}
+
+/* Reads the digits of a \u escape at aux, combining surrogate pairs */
+static const uint8_t* dejson_get_unicode(dejson_state_t* state, const uint8_t* aux, uint32_t* utf32)
+{
+  uint32_t code = dejson_get_hex(state, aux);
+  aux += 4;
+
+  if (state->error != DEJSON_OK)
+  {
+    return dejson_end;
+  }
+
+  if (code >= 0xd800 && code < 0xdc00)
+  {
+    if (aux[0] != '\\' || aux[1] != 'u')
+    {
+      dejson_fail(state, DEJSON_INVALID_ESCAPE);
+      return dejson_end;
+    }
+
+    uint32_t low = dejson_get_hex(state, aux + 2);
+
+    if (state->error != DEJSON_OK)
+    {
+      return dejson_end;
+    }
+
+    if (low < 0xdc00 || low >= 0xe000)
+    {
+      dejson_fail(state, DEJSON_INVALID_ESCAPE);
+      return dejson_end;
+    }
+
+    code = 0x10000 + ((code - 0xd800) << 10) + (low - 0xdc00);
+    aux += 6;
+  }
+  else if (code >= 0xdc00 && code < 0xe000)
+  {
+    dejson_fail(state, DEJSON_INVALID_ESCAPE);
+    return dejson_end;
   }
+
+  *utf32 = code;
+  return aux;
 }
 
 static size_t dejson_skip_string(dejson_state_t* state)
 {
   const uint8_t* aux = state->json + 1;
   size_t length = 0;
-  
-  if (*aux !='"')
+
+  for (;;)
   {
-    do
+    const uint8_t* stop = dejson_scan_string(aux, 1);
+    length += stop - aux;
+    aux = stop;
+
+    if (*aux == '"')
     {
-      length++;
+      break;
+    }
+    else if (*aux == 0)
+    {
+      dejson_fail(state, DEJSON_UNTERMINATED_STRING);
+      return 0;
+    }
+    else if (*aux != '\\')
+    {
+      size_t count = dejson_utf8_length(aux);
 
-      if (*aux++ == '\\')
+      if (count == 0)
       {
-        char digits[5];
-        uint32_t utf32;
+        dejson_fail(state, DEJSON_INVALID_UTF8);
+        return 0;
+      }
 
-        switch (*aux++)
-        {
-        case '"':
-        case '\\':
-        case '/':
-        case 'b':
-        case 'f':
-        case 'n':
-        case 'r':
-        case 't':
-          break;
-        
-        case 'u':
-          if (!isxdigit(aux[0] || !isxdigit(aux[1]) || !isxdigit(aux[2]) || !isxdigit(aux[3])))
-          {
-            longjmp(state->rollback, DEJSON_INVALID_ESCAPE);
-          }
-
-          digits[0] = aux[0];
-          digits[1] = aux[1];
-          digits[2] = aux[2];
-          digits[3] = aux[3];
-          digits[4] = 0;
-          aux += 4;
-          
-          utf32 = strtoul(digits, NULL, 16);
-
-          if (utf32 < 0x80U)
-          {
-          }
-          else if (utf32 < 0x800U)
-          {
-            length++;
-          }
-          else if (utf32 < 0x10000U)
-          {
-            length += 2;
-          }
-          else if (utf32 < 0x200000U)
-          {
-            length += 3;
-          }
-          else
-          {
-            longjmp(state->rollback, DEJSON_INVALID_ESCAPE);
-          }
-
-          break;
-        
-        default:
-          longjmp(state->rollback, DEJSON_INVALID_ESCAPE);
-        }
+      aux += count;
+      length += count;
+      continue;
+    }
+
+    uint32_t utf32;
+
+    switch (aux[1])
+    {
+    case '"':
+    case '\\':
+    case '/':
+    case 'b':
+    case 'f':
+    case 'n':
+    case 'r':
+    case 't':
+      aux += 2;
+      length++;
+      break;
+
+    case 'u':
+      aux = dejson_get_unicode(state, aux + 2, &utf32);
+
+      if (state->error != DEJSON_OK)
+      {
+        return 0;
       }
+
+      length += utf32 < 0x80 ? 1 : utf32 < 0x800 ? 2 : utf32 < 0x10000 ? 3 : 4;
+      break;
+
+    default:
+      dejson_fail(state, DEJSON_INVALID_ESCAPE);
+      return 0;
     }
-    while (*aux != '"');
   }
 
   state->json = aux + 1;
@@ -228,7 +535,8 @@ static void dejson_skip_null(dejson_state_t* state)
   }
   else
   {
-    longjmp(state->rollback, DEJSON_INVALID_VALUE);
+    dejson_fail(state, DEJSON_INVALID_VALUE);
+    return;
   }
 }
 
@@ -272,118 +580,324 @@ static void dejson_skip_value(dejson_state_t* state)
     break;
 
   default:
-    longjmp(state->rollback, DEJSON_INVALID_VALUE);
+    dejson_fail(state, DEJSON_INVALID_VALUE);
+    return;
   }
 
   dejson_skip_spaces(state);
 }
 
-static int64_t dejson_get_int64(dejson_state_t* state, int64_t min, int64_t max)
+static const uint64_t dejson_pow10[] =
 {
-  errno = 0;
+  1ULL, 10ULL, 100ULL, 1000ULL, 10000ULL, 100000ULL, 1000000ULL, 10000000ULL, 100000000ULL, 1000000000ULL,
+  10000000000ULL, 100000000000ULL, 1000000000000ULL, 10000000000000ULL, 100000000000000ULL,
+  1000000000000000ULL, 10000000000000000ULL, 100000000000000000ULL, 1000000000000000000ULL,
+  10000000000000000000ULL
+};
 
-  char* end;
-  long long result = strtoll((const char*)state->json, &end, 10);
+#ifdef DEJSON_HAS_SWAR
+#define DEJSON_SWAR_ONES UINT64_C(0x0101010101010101)
 
-  if ((result == 0 && end == (const char*)state->json) || errno == ERANGE || result < min || result > max)
-  {
-    longjmp(state->rollback, DEJSON_INVALID_VALUE);
-  }
+/* Converts eight digit values, with the first one in the lowest byte */
+static uint32_t dejson_swar_digits(uint64_t digits)
+{
+  digits = digits * 10 + (digits >> 8);
+  digits = ((digits & UINT64_C(0x000000ff000000ff)) * (100 + (UINT64_C(1000000) << 32)) +
+            ((digits >> 16) & UINT64_C(0x000000ff000000ff)) * (1 + (UINT64_C(10000) << 32))) >> 32;
 
-  state->json = (uint8_t*)end;
-  return result;
+  return (uint32_t)digits;
 }
-
-static uint64_t dejson_get_uint64(dejson_state_t* state, uint64_t max)
+#endif
+
+/*
+Reads up to 19 digits at json into value, which can't overflow, and returns
+where they end. With SWAR, up to eight digits are converted at a time when
+reading eight bytes doesn't cross into the next page, which makes reading past
+the end of the input safe.
+*/
+#ifdef DEJSON_HAS_SWAR
+__attribute__((no_sanitize_address))
+#endif
+static const uint8_t* dejson_get_digits(const uint8_t* json, uint64_t* value, unsigned* count)
 {
-  errno = 0;
+  uint64_t result = 0;
+  unsigned total = 0;
+
+#ifdef DEJSON_HAS_SWAR
+  while (total <= 11 && ((uintptr_t)json & 4095) <= 4096 - 8)
+  {
+    uint64_t bytes;
+    memcpy((void*)&bytes, (const void*)json, 8);
+
+    /* Digits have 3 in the high nibble before and after adding 6, non-zero bytes aren't digits */
+    uint64_t others = ((bytes & DEJSON_SWAR_ONES * 0xf0) | (((bytes + DEJSON_SWAR_ONES * 6) & DEJSON_SWAR_ONES * 0xf0) >> 4)) ^ DEJSON_SWAR_ONES * 0x33;
+    unsigned length = others != 0 ? __builtin_ctzll(others) >> 3 : 8;
+
+    if (length == 0)
+    {
+      break;
+    }
+
+    /* Shifting the digits up leaves zeros in front of them */
+    result = result * dejson_pow10[length] + dejson_swar_digits((bytes - DEJSON_SWAR_ONES * '0') << (8 * (8 - length)));
+    json += length;
+    total += length;
 
-  char* end;
-  unsigned long long result = strtoull((char*)state->json, &end, 10);
+    if (length < 8)
+    {
+      *value = result;
+      *count = total;
+      return json;
+    }
+  }
+#endif
 
-  if ((result == 0 && end == (const char*)state->json) || errno == ERANGE || result > max)
+  while (total < 19 && DEJSON_IS_DIGIT(*json))
   {
-    longjmp(state->rollback, DEJSON_INVALID_VALUE);
+    result = result * 10 + (*json++ - '0');
+    total++;
   }
 
-  state->json = (uint8_t*)end;
-  return result;
+  *value = result;
+  *count = total;
+  return json;
 }
 
-static double dejson_get_double(dejson_state_t* state, double min, double max)
+/* Reads an unsigned integer at json, or returns NULL if there isn't one, it has leading zeros, or it doesn't fit */
+static const uint8_t* dejson_get_integer(const uint8_t* json, uint64_t* value)
 {
-  errno = 0;
+  unsigned count;
+
+  if (json[0] == '0' && DEJSON_IS_DIGIT(json[1]))
+  {
+    return NULL;
+  }
 
-  char* end;
-  double result = strtod((const char*)state->json, &end);
+  json = dejson_get_digits(json, value, &count);
 
-  if ((result == 0.0 && end == (const char*)state->json) || errno == ERANGE || result < min || result > max)
+  if (count == 0)
   {
-    longjmp(state->rollback, DEJSON_INVALID_VALUE);
+    return NULL;
   }
 
-  state->json = (uint8_t*)end;
-  return result;
-}
+  if (DEJSON_IS_DIGIT(*json))
+  {
+    /* The twentieth digit may still fit */
+    unsigned digit = *json++ - '0';
 
-static void dejson_parse_char(dejson_state_t* state, void* data)
-{
-  *(char*)data = dejson_get_int64(state, CHAR_MIN, CHAR_MAX);
-}
+    if (DEJSON_IS_DIGIT(*json) || *value > (UINT64_MAX - digit) / 10)
+    {
+      return NULL;
+    }
 
-static void dejson_parse_uchar(dejson_state_t* state, void* data)
-{
-  *(unsigned char*)data = dejson_get_uint64(state, UCHAR_MAX);
-}
+    *value = *value * 10 + digit;
+  }
 
-static void dejson_parse_short(dejson_state_t* state, void* data)
-{
-  *(short*)data = dejson_get_int64(state, SHRT_MIN, SHRT_MAX);
+  return json;
 }
 
-static void dejson_parse_ushort(dejson_state_t* state, void* data)
+static int64_t dejson_get_int64(dejson_state_t* state, int64_t min, int64_t max)
 {
-  *(unsigned short*)data = dejson_get_uint64(state, USHRT_MAX);
-}
+  int negative = *state->json == '-';
+  uint64_t result;
+  const uint8_t* end = dejson_get_integer(state->json + negative, &result);
 
-static void dejson_parse_int(dejson_state_t* state, void* data)
-{
-  *(int*)data = dejson_get_int64(state, INT_MIN, INT_MAX);
-}
+  if (end == NULL || result > (negative ? (uint64_t)-(min + 1) + 1 : (uint64_t)max))
+  {
+    dejson_fail(state, DEJSON_INVALID_VALUE);
+    return 0;
+  }
 
-static void dejson_parse_uint(dejson_state_t* state, void* data)
-{
-  *(unsigned int*)data = dejson_get_uint64(state, UINT_MAX);
+  state->json = end;
+  return negative ? (int64_t)(0 - result) : (int64_t)result;
 }
 
-static void dejson_parse_long(dejson_state_t* state, void* data)
+static uint64_t dejson_get_uint64(dejson_state_t* state, uint64_t max)
 {
-  *(long*)data = dejson_get_int64(state, LONG_MIN, LONG_MAX);
-}
+  int negative = *state->json == '-';
+  uint64_t result;
+  const uint8_t* end = dejson_get_integer(state->json + negative, &result);
 
-static void dejson_parse_ulong(dejson_state_t* state, void* data)
-{
-  *(unsigned long*)data = dejson_get_uint64(state, ULONG_MAX);
-}
+  /* Only -0 is allowed */
+  if (end == NULL || result > (negative ? 0 : max))
+  {
+    dejson_fail(state, DEJSON_INVALID_VALUE);
+    return 0;
+  }
 
-static void dejson_parse_int8(dejson_state_t* state, void* data)
-{
-  *(int8_t*)data = dejson_get_int64(state, INT8_MIN, INT8_MAX);
+  state->json = end;
+  return result;
 }
 
-static void dejson_parse_int16(dejson_state_t* state, void* data)
+static const double dejson_pow10_double[] =
 {
-  *(int16_t*)data = dejson_get_int64(state, INT16_MIN, INT16_MAX);
-}
+  1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+  1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
 
-static void dejson_parse_int32(dejson_state_t* state, void* data)
+/*
+Clinger's fast path: mantissas up to 2^53 are exact in a double, and so are
+powers of ten up to 10^22, so multiplying or dividing one by the other is
+correctly rounded. Returns zero for everything else, which is left to strtod.
+*/
+static int dejson_get_fast_double(const uint8_t** json, double* value)
 {
-  *(int32_t*)data = dejson_get_int64(state, INT32_MIN, INT32_MAX);
-}
+  const uint8_t* aux = *json;
+  int negative = *aux == '-';
+  uint64_t mantissa, fraction;
+  unsigned count, fraction_count;
+  int exponent = 0;
 
-static void dejson_parse_int64(dejson_state_t* state, void* data)
-{
-  *(int64_t*)data = dejson_get_int64(state, INT64_MIN, INT64_MAX);
+  aux = dejson_get_digits(aux + negative, &mantissa, &count);
+
+  if (count == 0 || DEJSON_IS_DIGIT(*aux) || (count > 1 && aux[-(int)count] == '0'))
+  {
+    return 0;
+  }
+
+  if (*aux == '.')
+  {
+    aux = dejson_get_digits(aux + 1, &fraction, &fraction_count);
+
+    if (fraction_count == 0 || count + fraction_count > 19 || DEJSON_IS_DIGIT(*aux))
+    {
+      return 0;
+    }
+
+    mantissa = mantissa * dejson_pow10[fraction_count] + fraction;
+    exponent = -(int)fraction_count;
+  }
+
+  if ((*aux | 0x20) == 'e')
+  {
+    const uint8_t* digits = aux + 1 + (aux[1] == '+' || aux[1] == '-');
+    int value = 0;
+
+    /* Without digits, the number ends before the e just like with strtod */
+    if (DEJSON_IS_DIGIT(*digits))
+    {
+      while (DEJSON_IS_DIGIT(*digits) && value < 1000)
+      {
+        value = value * 10 + (*digits++ - '0');
+      }
+
+      exponent += aux[1] == '-' ? -value : value;
+      aux = digits;
+    }
+  }
+
+  if (mantissa > (UINT64_C(1) << 53) || exponent < -22 || exponent > 22 || DEJSON_IS_DIGIT(*aux))
+  {
+    return 0;
+  }
+
+  double result = (double)mantissa;
+  result = exponent < 0 ? result / dejson_pow10_double[-exponent] : result * dejson_pow10_double[exponent];
+
+  *value = negative ? -result : result;
+  *json = aux;
+  return 1;
+}
+
+static double dejson_get_double(dejson_state_t* state, double min, double max)
+{
+  double result;
+
+  if (!dejson_get_fast_double(&state->json, &result))
+  {
+    const uint8_t* json = state->json;
+
+    /*
+    strtod also takes things that aren't JSON numbers, like hexadecimals,
+    infinities, leading zeros and 1., so it must stop where the JSON syntax
+    says the number ends.
+    */
+    dejson_skip_number(state);
+
+    if (state->error != DEJSON_OK)
+    {
+      return 0;
+    }
+
+    errno = 0;
+
+    char* end;
+    result = strtod((const char*)json, &end);
+
+    if ((const uint8_t*)end != state->json || errno == ERANGE)
+    {
+      dejson_fail(state, DEJSON_INVALID_VALUE);
+      return 0;
+    }
+  }
+
+  if (result < min || result > max)
+  {
+    dejson_fail(state, DEJSON_INVALID_VALUE);
+    return 0;
+  }
+
+  return result;
+}
+
+static void dejson_parse_char(dejson_state_t* state, void* data)
+{
+  *(char*)data = dejson_get_int64(state, CHAR_MIN, CHAR_MAX);
+}
+
+static void dejson_parse_uchar(dejson_state_t* state, void* data)
+{
+  *(unsigned char*)data = dejson_get_uint64(state, UCHAR_MAX);
+}
+
+static void dejson_parse_short(dejson_state_t* state, void* data)
+{
+  *(short*)data = dejson_get_int64(state, SHRT_MIN, SHRT_MAX);
+}
+
+static void dejson_parse_ushort(dejson_state_t* state, void* data)
+{
+  *(unsigned short*)data = dejson_get_uint64(state, USHRT_MAX);
+}
+
+static void dejson_parse_int(dejson_state_t* state, void* data)
+{
+  *(int*)data = dejson_get_int64(state, INT_MIN, INT_MAX);
+}
+
+static void dejson_parse_uint(dejson_state_t* state, void* data)
+{
+  *(unsigned int*)data = dejson_get_uint64(state, UINT_MAX);
+}
+
+static void dejson_parse_long(dejson_state_t* state, void* data)
+{
+  *(long*)data = dejson_get_int64(state, LONG_MIN, LONG_MAX);
+}
+
+static void dejson_parse_ulong(dejson_state_t* state, void* data)
+{
+  *(unsigned long*)data = dejson_get_uint64(state, ULONG_MAX);
+}
+
+static void dejson_parse_int8(dejson_state_t* state, void* data)
+{
+  *(int8_t*)data = dejson_get_int64(state, INT8_MIN, INT8_MAX);
+}
+
+static void dejson_parse_int16(dejson_state_t* state, void* data)
+{
+  *(int16_t*)data = dejson_get_int64(state, INT16_MIN, INT16_MAX);
+}
+
+static void dejson_parse_int32(dejson_state_t* state, void* data)
+{
+  *(int32_t*)data = dejson_get_int64(state, INT32_MIN, INT32_MAX);
+}
+
+static void dejson_parse_int64(dejson_state_t* state, void* data)
+{
+  *(int64_t*)data = dejson_get_int64(state, INT64_MIN, INT64_MAX);
 }
 
 static void dejson_parse_uint8(dejson_state_t* state, void* data)
@@ -408,12 +922,12 @@ static void dejson_parse_uint64(dejson_state_t* state, void* data)
 
 static void dejson_parse_float(dejson_state_t* state, void* data)
 {
-  *(float*)data = dejson_get_double(state, FLT_MIN, FLT_MAX);
+  *(float*)data = dejson_get_double(state, -FLT_MAX, FLT_MAX);
 }
 
 static void dejson_parse_double(dejson_state_t* state, void* data)
 {
-  *(double*)data = dejson_get_double(state, DBL_MIN, DBL_MAX);
+  *(double*)data = dejson_get_double(state, -DBL_MAX, DBL_MAX);
 }
 
 static void dejson_parse_boolean(dejson_state_t* state, void* data)
@@ -432,339 +946,2353 @@ static void dejson_parse_boolean(dejson_state_t* state, void* data)
   }
   else
   {
-    longjmp(state->rollback, DEJSON_INVALID_VALUE);
+    dejson_fail(state, DEJSON_INVALID_VALUE);
+    return;
   }
 }
 
-static void dejson_parse_string(dejson_state_t* state, void* data)
+static const uint8_t* dejson_decode_escape(dejson_state_t* state, const uint8_t* aux, uint8_t* str, size_t* length)
+{
+  uint32_t utf32;
+
+  aux++;
+  *length = 1;
+
+  switch (*aux++)
+  {
+  case '"':  *str = '"'; break;
+  case '\\': *str = '\\'; break;
+  case '/':  *str = '/'; break;
+  case 'b':  *str = '\b'; break;
+  case 'f':  *str = '\f'; break;
+  case 'n':  *str = '\n'; break;
+  case 'r':  *str = '\r'; break;
+  case 't':  *str = '\t'; break;
+
+  case 'u':
+    aux = dejson_get_unicode(state, aux, &utf32);
+
+    if (state->error != DEJSON_OK)
+    {
+      *length = 0;
+      return aux;
+    }
+    else if (utf32 < 0x80)
+    {
+      str[0] = utf32;
+    }
+    else if (utf32 < 0x800)
+    {
+      str[0] = 0xc0 | (utf32 >> 6);
+      str[1] = 0x80 | (utf32 & 0x3f);
+      *length = 2;
+    }
+    else if (utf32 < 0x10000)
+    {
+      str[0] = 0xe0 | (utf32 >> 12);
+      str[1] = 0x80 | ((utf32 >> 6) & 0x3f);
+      str[2] = 0x80 | (utf32 & 0x3f);
+      *length = 3;
+    }
+    else
+    {
+      str[0] = 0xf0 | (utf32 >> 18);
+      str[1] = 0x80 | ((utf32 >> 12) & 0x3f);
+      str[2] = 0x80 | ((utf32 >> 6) & 0x3f);
+      str[3] = 0x80 | (utf32 & 0x3f);
+      *length = 4;
+    }
+
+    break;
+
+  default:
+    dejson_fail(state, DEJSON_INVALID_ESCAPE);
+    return dejson_end;
+  }
+
+  return aux;
+}
+
+/* Returns the decoded length, which is only known when deserializing */
+static size_t dejson_get_string(dejson_state_t* state, dejson_string_t* data)
 {
   const uint8_t* aux = state->json;
+
+  if (*aux++ != '"')
+  {
+    dejson_fail(state, DEJSON_INVALID_VALUE);
+    return 0;
+  }
+
   size_t length = dejson_skip_string(state);
   uint8_t* str = (uint8_t*)dejson_alloc(state, length + 1, DEJSON_ALIGNOF(char));
 
   if (state->counting)
   {
-    return;
+    return 0;
   }
 
-  if (*aux++ != '"')
+  data->chars = (char*)str;
+
+  /* dejson_skip_string already validated the string, so only escapes need attention */
+  for (;;)
   {
-    longjmp(state->rollback, DEJSON_INVALID_VALUE);
+    const uint8_t* stop = dejson_scan_string(aux, 0);
+    memcpy((void*)str, (const void*)aux, stop - aux);
+    str += stop - aux;
+    aux = stop;
+
+    if (*aux != '\\')
+    {
+      break;
+    }
+
+    aux = dejson_decode_escape(state, aux, str, &length);
+    str += length;
   }
 
-  ((dejson_string_t*)data)->chars = (char*)str;
-  
-  if (*aux !='"')
+  *str = 0;
+  return str - (uint8_t*)data->chars;
+}
+
+static void dejson_parse_string(dejson_state_t* state, void* data)
+{
+  dejson_get_string(state, (dejson_string_t*)data);
+}
+
+/* Hashes the decoded contents of the string at json without allocating them */
+static uint32_t dejson_hash_string(dejson_state_t* state, const uint8_t* json, size_t* length)
+{
+  uint32_t hash = 5381;
+  size_t count = 0;
+
+  for (json++; *json != '"';)
   {
-    do
+    uint8_t utf8[4];
+    size_t i, n = 1;
+
+    if (*json == 0)
+    {
+      dejson_fail(state, DEJSON_UNTERMINATED_STRING);
+      break;
+    }
+    else if (*json == '\\')
     {
-      if (*aux == '\\')
+      json = dejson_decode_escape(state, json, utf8, &n);
+
+      if (state->error != DEJSON_OK)
       {
-        char digits[5];
-        uint32_t utf32;
+        break;
+      }
+    }
+    else
+    {
+      utf8[0] = *json++;
+    }
 
-        aux++;
+    for (i = 0; i < n; i++)
+    {
+      hash = hash * 33 + utf8[i];
+    }
 
-        switch (*aux++)
-        {
-        case '"':  *str++ = '"'; break;
-        case '\\': *str++ = '\\'; break;
-        case '/':  *str++ = '/'; break;
-        case 'b':  *str++ = '\b'; break;
-        case 'f':  *str++ = '\f'; break;
-        case 'n':  *str++ = '\n'; break;
-        case 'r':  *str++ = '\r'; break;
-        case 't':  *str++ = '\t'; break;
-        
-        case 'u':
-          digits[0] = aux[0];
-          digits[1] = aux[1];
-          digits[2] = aux[2];
-          digits[3] = aux[3];
-          digits[4] = 0;
-          aux += 4;
-
-          utf32 = strtoul(digits, NULL, 16);
-
-          if (utf32 < 0x80)
-          {
-            *str++ = utf32;
-          }
-          else if (utf32 < 0x800)
-          {
-            str[0] = 0xc0 | (utf32 >> 6);
-            str[1] = 0x80 | (utf32 & 0x3f);
-            str += 2;
-          }
-          else if (utf32 < 0x10000)
-          {
-            str[0] = 0xe0 | (utf32 >> 12);
-            str[1] = 0x80 | ((utf32 >> 6) & 0x3f);
-            str[2] = 0x80 | (utf32 & 0x3f);
-            str += 3;
-          }
-          else
-          {
-            str[0] = 0xf0 | (utf32 >> 18);
-            str[1] = 0x80 | ((utf32 >> 12) & 0x3f);
-            str[2] = 0x80 | ((utf32 >> 6) & 0x3f);
-            str[3] = 0x80 | (utf32 & 0x3f);
-            str += 4;
-          }
-
-          break;
-        
-        default:
-          longjmp(state->rollback, DEJSON_INVALID_ESCAPE);
-        }
-      }
-      else
+    count += n;
+  }
+
+  *length = count;
+  return hash;
+}
+
+/* Compares the decoded contents of the string at json with chars, which must have the same length */
+static int dejson_string_equals(dejson_state_t* state, const uint8_t* json, const char* chars)
+{
+  for (json++; *json != '"';)
+  {
+    uint8_t utf8[4];
+    size_t n = 1;
+
+    if (*json == '\\')
+    {
+      json = dejson_decode_escape(state, json, utf8, &n);
+
+      if (state->error != DEJSON_OK)
       {
-        *str++ = *aux++;
+        return 0;
       }
     }
-    while (*aux != '"');
+    else
+    {
+      utf8[0] = *json++;
+    }
+
+    if (memcmp((const void*)utf8, (const void*)chars, n) != 0)
+    {
+      return 0;
+    }
+
+    chars += n;
   }
 
-  *str = 0;
+  return 1;
 }
 
-typedef void (*dejson_parser_t)(dejson_state_t*, void*);
+/* Stands in for an unknown enumeration once the parse has failed */
+static const dejson_enum_meta_t dejson_no_enum = {NULL, NULL, 0, 0, 0, 0, 0, 1};
 
-static const dejson_parser_t dejson_parsers[] =
+static const dejson_enum_meta_t* dejson_get_enum(dejson_state_t* state, uint32_t hash)
 {
-  dejson_parse_char, dejson_parse_uchar, dejson_parse_short, dejson_parse_ushort,
-  dejson_parse_int, dejson_parse_uint, dejson_parse_long, dejson_parse_ulong,
-  dejson_parse_int8, dejson_parse_int16, dejson_parse_int32, dejson_parse_int64,
-  dejson_parse_uint8, dejson_parse_uint16, dejson_parse_uint32, dejson_parse_uint64,
-  dejson_parse_float, dejson_parse_double, dejson_parse_boolean, dejson_parse_string
-};
+  const dejson_enum_meta_t* meta = dejson_resolve_enum(hash);
 
-static void dejson_parse_value(dejson_state_t*, void*, const dejson_record_field_meta_t*);
-static void dejson_parse_object(dejson_state_t*, void*, const dejson_record_meta_t*);
+  if (meta == NULL)
+  {
+    dejson_fail(state, DEJSON_UNKNOWN_ENUM);
+    return &dejson_no_enum;
+  }
 
-static void dejson_parse_array(dejson_state_t* state, void* value, size_t element_size, size_t element_alignment, const dejson_record_field_meta_t* field)
+  return meta;
+}
+
+static void dejson_parse_enum(dejson_state_t* state, void* data, const dejson_enum_meta_t* meta)
 {
-  if (*state->json != '[')
+  const uint8_t* aux = state->json;
+
+  if (*aux != '"')
   {
-    longjmp(state->rollback, DEJSON_INVALID_VALUE);
+    dejson_fail(state, DEJSON_INVALID_VALUE);
+    return;
   }
 
-  const uint8_t* save = state->json;
-  size_t count = dejson_skip_array(state);
-  state->json = save + 1;
+  dejson_skip_string(state);
 
-  uint8_t* elements = (uint8_t*)dejson_alloc(state, element_size * count, element_alignment);
-  
-  dejson_array_t* array = (dejson_array_t*)value;
+  if (state->counting)
+  {
+    return;
+  }
 
-  if (!state->counting)
+  size_t length;
+  uint32_t hash = dejson_hash_string(state, aux, &length);
+  const dejson_enum_value_meta_t* slot = meta->slots + (((hash * meta->multiplier) >> meta->shift) & meta->mask);
+  uint32_t value = 0;
+
+  if (slot->name != NULL && slot->hash == hash && slot->length == length && dejson_string_equals(state, aux, slot->name))
   {
-    array->elements = elements;
-    array->count = count;
-    array->element_size = element_size;
+    value = slot->value;
   }
 
-  dejson_skip_spaces(state);
+  switch (meta->size)
+  {
+  case 1:
+    *(uint8_t*)data = value;
+    break;
 
-  dejson_record_field_meta_t field_scalar = *field;
-  field_scalar.flags &= ~DEJSON_FLAG_ARRAY;
+  case 2:
+    *(uint16_t*)data = value;
+    break;
 
-  while (*state->json != ']')
+  default:
+    *(uint32_t*)data = value;
+    break;
+  }
+}
+
+/* Keeps the value in the input, it's only skipped to find where it ends */
+static void dejson_parse_json(dejson_state_t* state, void* data)
+{
+  const uint8_t* json = state->json;
+  dejson_skip_value(state);
+
+  if (!state->counting)
   {
-    dejson_parse_value(state, (void*)elements, &field_scalar);
-    dejson_skip_spaces(state);
+    /* dejson_skip_value also skips the spaces after the value */
+    const uint8_t* end = state->json;
 
-    elements += element_size;
-    
-    if (*state->json != ',')
+    while (DEJSON_IS_SPACE(end[-1]))
     {
-      break;
+      end--;
     }
 
-    state->json++;
-    dejson_skip_spaces(state);
+    ((dejson_json_t*)data)->chars = (const char*)json;
+    ((dejson_json_t*)data)->length = end - json;
   }
+}
 
-  if (*state->json != ']')
+static int dejson_base64_value(uint8_t c)
+{
+  if (c >= 'A' && c <= 'Z')
+  {
+    return c - 'A';
+  }
+  else if (c >= 'a' && c <= 'z')
+  {
+    return c - 'a' + 26;
+  }
+  else if (c >= '0' && c <= '9')
   {
-    longjmp(state->rollback, DEJSON_UNTERMINATED_ARRAY);
+    return c - '0' + 52;
+  }
+  else if (c == '+')
+  {
+    return 62;
+  }
+  else if (c == '/')
+  {
+    return 63;
   }
 
-  state->json++;
+  return -1;
 }
 
-static void dejson_parse_value(dejson_state_t* state, void* value, const dejson_record_field_meta_t* field)
+#ifdef DEJSON_HAS_SSE2
+/*
+Decodes 16 base64 characters into 12 bytes at out, or only checks them when
+out is NULL. Returns zero without writing anything if any of the characters
+isn't in the alphabet, so that the caller can deal with them.
+*/
+static int dejson_base64_block(const uint8_t* chars, uint8_t* out)
 {
-#define DEJSON_TYPE_INFO(t) sizeof(t), DEJSON_ALIGNOF(t)
-  
-  static const size_t dejson_type_info[] =
-  {
-    DEJSON_TYPE_INFO(char), DEJSON_TYPE_INFO(unsigned char), DEJSON_TYPE_INFO(short), DEJSON_TYPE_INFO(unsigned short),
-    DEJSON_TYPE_INFO(int), DEJSON_TYPE_INFO(unsigned int), DEJSON_TYPE_INFO(long), DEJSON_TYPE_INFO(unsigned long),
-    DEJSON_TYPE_INFO(int8_t), DEJSON_TYPE_INFO(int16_t), DEJSON_TYPE_INFO(int32_t), DEJSON_TYPE_INFO(int64_t),
-    DEJSON_TYPE_INFO(uint8_t), DEJSON_TYPE_INFO(uint16_t), DEJSON_TYPE_INFO(uint32_t), DEJSON_TYPE_INFO(uint64_t),
-    DEJSON_TYPE_INFO(float), DEJSON_TYPE_INFO(double), DEJSON_TYPE_INFO(char), DEJSON_TYPE_INFO(dejson_string_t)
-  };
+  __m128i c = _mm_loadu_si128((const __m128i*)chars);
+
+  /* Bytes with the most significant bit set are negative, and fall out of all ranges */
+  __m128i upper = _mm_and_si128(_mm_cmpgt_epi8(c, _mm_set1_epi8('A' - 1)), _mm_cmplt_epi8(c, _mm_set1_epi8('Z' + 1)));
+  __m128i lower = _mm_and_si128(_mm_cmpgt_epi8(c, _mm_set1_epi8('a' - 1)), _mm_cmplt_epi8(c, _mm_set1_epi8('z' + 1)));
+  __m128i digit = _mm_and_si128(_mm_cmpgt_epi8(c, _mm_set1_epi8('0' - 1)), _mm_cmplt_epi8(c, _mm_set1_epi8('9' + 1)));
+  __m128i plus = _mm_cmpeq_epi8(c, _mm_set1_epi8('+'));
+  __m128i slash = _mm_cmpeq_epi8(c, _mm_set1_epi8('/'));
+
+  if (_mm_movemask_epi8(_mm_or_si128(_mm_or_si128(_mm_or_si128(upper, lower), _mm_or_si128(digit, plus)), slash)) != 0xffff)
+  {
+    return 0;
+  }
+
+  if (out == NULL)
+  {
+    return 1;
+  }
+
+  __m128i offset = _mm_or_si128(_mm_and_si128(upper, _mm_set1_epi8(-'A')), _mm_and_si128(lower, _mm_set1_epi8(26 - 'a')));
+  offset = _mm_or_si128(offset, _mm_and_si128(digit, _mm_set1_epi8(52 - '0')));
+  offset = _mm_or_si128(offset, _mm_or_si128(_mm_and_si128(plus, _mm_set1_epi8(62 - '+')), _mm_and_si128(slash, _mm_set1_epi8(63 - '/'))));
+  __m128i values = _mm_add_epi8(c, offset);
+
+  /* Merges pairs of 6-bit values into 12 bits, and then pairs of those into 24 bits */
+  __m128i pairs = _mm_or_si128(_mm_slli_epi16(_mm_and_si128(values, _mm_set1_epi16(0xff)), 6), _mm_srli_epi16(values, 8));
+  __m128i quads = _mm_or_si128(_mm_slli_epi32(_mm_and_si128(pairs, _mm_set1_epi32(0xffff)), 12), _mm_srli_epi32(pairs, 16));
+
+  uint32_t words[4];
+  _mm_storeu_si128((__m128i*)words, quads);
+
+  unsigned i;
+
+  for (i = 0; i < 4; i++, out += 3)
+  {
+    out[0] = words[i] >> 16;
+    out[1] = words[i] >> 8;
+    out[2] = words[i];
+  }
+
+  return 1;
+}
+#endif
+
+/*
+Decodes the base64 string at json into out, or only checks it when out is
+NULL, and returns the number of bytes. Padding is optional, and \/ is the only
+escape allowed.
+*/
+static size_t dejson_decode_base64(dejson_state_t* state, uint8_t* out)
+{
+  const uint8_t* aux = state->json + 1;
+  const uint8_t* stop = aux - 1;
+  uint32_t bits = 0;
+  unsigned count = 0, padding = 0;
+  size_t length = 0;
+
+  for (;;)
+  {
+    if (aux > stop)
+    {
+      stop = dejson_scan_string(aux, 1);
+    }
+
+#ifdef DEJSON_HAS_SSE2
+    while (count == 0 && padding == 0 && stop - aux >= 16 && dejson_base64_block(aux, out != NULL ? out + length : NULL))
+    {
+      aux += 16;
+      length += 12;
+    }
+#endif
+
+    uint8_t c;
+
+    if (aux < stop)
+    {
+      c = *aux++;
+    }
+    else if (*aux == '"')
+    {
+      break;
+    }
+    else if (aux[0] == '\\' && aux[1] == '/')
+    {
+      c = '/';
+      aux += 2;
+    }
+    else if (*aux == 0)
+    {
+      dejson_fail(state, DEJSON_UNTERMINATED_STRING);
+      return 0;
+    }
+    else
+    {
+      dejson_fail(state, DEJSON_INVALID_VALUE);
+      return 0;
+    }
+
+    if (c == '=')
+    {
+      padding++;
+      continue;
+    }
+
+    int value = dejson_base64_value(c);
+
+    if (value < 0 || padding != 0)
+    {
+      dejson_fail(state, DEJSON_INVALID_VALUE);
+      return 0;
+    }
+
+    bits = bits << 6 | value;
+
+    if (++count == 4)
+    {
+      if (out != NULL)
+      {
+        out[length] = bits >> 16;
+        out[length + 1] = bits >> 8;
+        out[length + 2] = bits;
+      }
+
+      length += 3;
+      count = 0;
+    }
+  }
+
+  if (count == 1 || (padding != 0 && count + padding != 4))
+  {
+    dejson_fail(state, DEJSON_INVALID_VALUE);
+    return 0;
+  }
+
+  if (count != 0)
+  {
+    if (out != NULL)
+    {
+      out[length] = count == 2 ? bits >> 4 : bits >> 10;
+
+      if (count == 3)
+      {
+        out[length + 1] = bits >> 2;
+      }
+    }
+
+    length += count - 1;
+  }
+
+  state->json = aux + 1;
+  return length;
+}
+
+static void dejson_parse_bytes(dejson_state_t* state, void* data)
+{
+  if (*state->json != '"')
+  {
+    dejson_fail(state, DEJSON_INVALID_VALUE);
+    return;
+  }
+
+  /*
+  Decodes right into the buffer, which is only allocated when the length is
+  known. A bounded buffer is measured first so the decoder can't run past it.
+  */
+  const uint8_t* json = state->json;
+  uint8_t* out = state->counting || state->limit != UINTPTR_MAX ? NULL : (uint8_t*)state->buffer;
+  size_t length = dejson_decode_base64(state, out);
+  void* bytes = dejson_alloc(state, length, 1);
+
+  if (out == NULL && !state->counting)
+  {
+    state->json = json;
+    dejson_decode_base64(state, (uint8_t*)bytes);
+  }
+
+  if (!state->counting)
+  {
+    ((dejson_bytes_t*)data)->data = (const uint8_t*)bytes;
+    ((dejson_bytes_t*)data)->length = length;
+  }
+}
+
+/*
+A switch rather than a table of function pointers, so that the compiler can
+inline the parsers into their callers. Records and enumerations have their own
+paths.
+*/
+static void dejson_parse_native(dejson_state_t* state, void* data, uint8_t type)
+{
+  switch (type)
+  {
+  case DEJSON_TYPE_CHAR:
+    dejson_parse_char(state, data);
+    break;
+
+  case DEJSON_TYPE_UCHAR:
+    dejson_parse_uchar(state, data);
+    break;
+
+  case DEJSON_TYPE_SHORT:
+    dejson_parse_short(state, data);
+    break;
+
+  case DEJSON_TYPE_USHORT:
+    dejson_parse_ushort(state, data);
+    break;
+
+  case DEJSON_TYPE_INT:
+    dejson_parse_int(state, data);
+    break;
+
+  case DEJSON_TYPE_UINT:
+    dejson_parse_uint(state, data);
+    break;
+
+  case DEJSON_TYPE_LONG:
+    dejson_parse_long(state, data);
+    break;
+
+  case DEJSON_TYPE_ULONG:
+    dejson_parse_ulong(state, data);
+    break;
+
+  case DEJSON_TYPE_INT8:
+    dejson_parse_int8(state, data);
+    break;
+
+  case DEJSON_TYPE_INT16:
+    dejson_parse_int16(state, data);
+    break;
+
+  case DEJSON_TYPE_INT32:
+    dejson_parse_int32(state, data);
+    break;
+
+  case DEJSON_TYPE_INT64:
+    dejson_parse_int64(state, data);
+    break;
+
+  case DEJSON_TYPE_UINT8:
+    dejson_parse_uint8(state, data);
+    break;
+
+  case DEJSON_TYPE_UINT16:
+    dejson_parse_uint16(state, data);
+    break;
+
+  case DEJSON_TYPE_UINT32:
+    dejson_parse_uint32(state, data);
+    break;
+
+  case DEJSON_TYPE_UINT64:
+    dejson_parse_uint64(state, data);
+    break;
+
+  case DEJSON_TYPE_FLOAT:
+    dejson_parse_float(state, data);
+    break;
+
+  case DEJSON_TYPE_DOUBLE:
+    dejson_parse_double(state, data);
+    break;
+
+  case DEJSON_TYPE_BOOL:
+    dejson_parse_boolean(state, data);
+    break;
+
+  case DEJSON_TYPE_STRING:
+    dejson_parse_string(state, data);
+    break;
+
+  case DEJSON_TYPE_JSON:
+    dejson_parse_json(state, data);
+    break;
+
+  case DEJSON_TYPE_BYTES:
+    dejson_parse_bytes(state, data);
+    break;
+  }
+}
+
+#define DEJSON_TYPE_INFO(t) sizeof(t), DEJSON_ALIGNOF(t)
+
+static const size_t dejson_type_info[] =
+{
+  DEJSON_TYPE_INFO(char), DEJSON_TYPE_INFO(unsigned char), DEJSON_TYPE_INFO(short), DEJSON_TYPE_INFO(unsigned short),
+  DEJSON_TYPE_INFO(int), DEJSON_TYPE_INFO(unsigned int), DEJSON_TYPE_INFO(long), DEJSON_TYPE_INFO(unsigned long),
+  DEJSON_TYPE_INFO(int8_t), DEJSON_TYPE_INFO(int16_t), DEJSON_TYPE_INFO(int32_t), DEJSON_TYPE_INFO(int64_t),
+  DEJSON_TYPE_INFO(uint8_t), DEJSON_TYPE_INFO(uint16_t), DEJSON_TYPE_INFO(uint32_t), DEJSON_TYPE_INFO(uint64_t),
+  DEJSON_TYPE_INFO(float), DEJSON_TYPE_INFO(double), DEJSON_TYPE_INFO(char), DEJSON_TYPE_INFO(dejson_string_t),
+  0, 0, 0, 0, DEJSON_TYPE_INFO(dejson_json_t), DEJSON_TYPE_INFO(dejson_bytes_t)
+};
+
+static uint32_t dejson_index_hash(const void* key, uint8_t type)
+{
+  if (type == DEJSON_TYPE_STRING)
+  {
+    const char* chars = *(const char* const*)key;
+    return dejson_hash((const uint8_t*)chars, strlen(chars));
+  }
+
+  return dejson_hash((const uint8_t*)key, dejson_type_info[type * 2]);
+}
+
+static uint32_t* dejson_index_slot(const dejson_indexed_array_t* array, const void* key, uint32_t hash)
+{
+  uint32_t mask = array->capacity - 1;
+  uint32_t ndx = (hash ^ (hash >> 16)) & mask;
+
+  for (;;)
+  {
+    uint32_t* slot = array->slots + ndx;
+
+    if (*slot == 0)
+    {
+      return slot;
+    }
+
+    const uint8_t* element_key = (const uint8_t*)DEJSON_GET_ELEMENT(*array, (*slot - 1)) + array->key_offset;
+
+    if (array->key_type == DEJSON_TYPE_STRING)
+    {
+      const char* chars = *(const char* const*)element_key;
+
+      if (chars != NULL && strcmp(chars, *(const char* const*)key) == 0)
+      {
+        return slot;
+      }
+    }
+    else if (memcmp((const void*)element_key, key, dejson_type_info[array->key_type * 2]) == 0)
+    {
+      return slot;
+    }
+
+    ndx = (ndx + 1) & mask;
+  }
+}
+
+static const dejson_record_field_meta_t* dejson_index_key(dejson_state_t* state, const dejson_record_field_meta_t* field)
+{
+  const dejson_record_meta_t* meta = dejson_resolve_record(field->type_hash);
+
+  if (meta == NULL)
+  {
+    dejson_fail(state, DEJSON_UNKOWN_RECORD);
+    return NULL;
+  }
+
+  unsigned i;
+  const dejson_record_field_meta_t* key;
+
+  for (i = 0, key = meta->fields; i < meta->num_fields; i++, key++)
+  {
+    if (key->name_hash == field->key_hash)
+    {
+      if ((key->flags & (DEJSON_FLAG_ARRAY | DEJSON_FLAG_POINTER | DEJSON_FLAG_MAP)) != 0 || key->type > DEJSON_TYPE_STRING || key->type == DEJSON_TYPE_FLOAT ||
+          key->type == DEJSON_TYPE_DOUBLE || key->type == DEJSON_TYPE_BOOL)
+      {
+        break;
+      }
+
+      return key;
+    }
+  }
+
+  dejson_fail(state, DEJSON_INVALID_INDEX);
+  return NULL;
+}
+
+/* Parses the value of a field of a native type, honoring the quoted and converted flags */
+static void dejson_parse_scalar(dejson_state_t* state, void* value, const dejson_record_field_meta_t* field)
+{
+  if ((field->flags & DEJSON_FLAG_CONVERTED) != 0)
+  {
+    dejson_converter_t converter = dejson_resolve_converter(field->type_hash);
+
+    if (converter == NULL)
+    {
+      dejson_fail(state, DEJSON_UNKNOWN_CONVERTER);
+      return;
+    }
+
+    const uint8_t* aux = state->json;
+
+    if (*aux != '"')
+    {
+      dejson_fail(state, DEJSON_INVALID_VALUE);
+      return;
+    }
+
+    dejson_skip_string(state);
+
+    if (state->error != DEJSON_OK)
+    {
+      return;
+    }
+
+    if (!converter(value, (const char*)aux + 1, state->json - aux - 2))
+    {
+      dejson_fail(state, DEJSON_INVALID_VALUE);
+      return;
+    }
+  }
+  else if ((field->flags & DEJSON_FLAG_QUOTED) != 0 && *state->json == '"')
+  {
+    state->json++;
+    dejson_parse_native(state, value, field->type);
+
+    if (*state->json != '"')
+    {
+      dejson_fail(state, DEJSON_INVALID_VALUE);
+      return;
+    }
+
+    state->json++;
+  }
+  else
+  {
+    dejson_parse_native(state, value, field->type);
+  }
+}
+
+static void dejson_parse_value(dejson_state_t*, void*, const dejson_record_field_meta_t*);
+static void dejson_parse_object(dejson_state_t*, void*, const dejson_record_meta_t*);
+
+/* Returns the first closing bracket or NUL at or after json, adding the commas before it to count */
+#ifdef DEJSON_HAS_SSE2
+__attribute__((no_sanitize_address))
+static const uint8_t* dejson_scan_commas(const uint8_t* json, size_t* count)
+{
+  const __m128i bracket = _mm_set1_epi8(']');
+  const __m128i comma = _mm_set1_epi8(',');
+  const __m128i zero = _mm_setzero_si128();
+
+  const uint8_t* block = (const uint8_t*)((uintptr_t)json & ~(uintptr_t)15);
+  unsigned skip = json - block;
+
+  for (;;)
+  {
+    __m128i bytes = _mm_load_si128((const __m128i*)block);
+    unsigned stops = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(bytes, bracket), _mm_cmpeq_epi8(bytes, zero)));
+    unsigned commas = _mm_movemask_epi8(_mm_cmpeq_epi8(bytes, comma));
+
+    stops = (stops >> skip) << skip;
+    commas = (commas >> skip) << skip;
+
+    if (stops != 0)
+    {
+      unsigned stop = __builtin_ctz(stops);
+      *count += __builtin_popcount(commas & ((1U << stop) - 1));
+      return block + stop;
+    }
+
+    *count += __builtin_popcount(commas);
+    block += 16;
+    skip = 0;
+  }
+}
+#else
+static const uint8_t* dejson_scan_commas(const uint8_t* json, size_t* count)
+{
+  while (*json != ']' && *json != 0)
+  {
+    *count += *json++ == ',';
+  }
+
+  return json;
+}
+#endif
+
+/* Numbers can't have commas, so counting them is enough to size arrays of numbers */
+static size_t dejson_count_numbers(dejson_state_t* state)
+{
+  const uint8_t* json = state->json;
+  size_t count = 0;
+
+  for (;;)
+  {
+    json = dejson_scan_commas(json, &count);
+
+    if (*json != 0 || state->feed == NULL || !state->feed->more(state->feed, json))
+    {
+      break;
+    }
+  }
+
+  while (json > state->json && DEJSON_IS_SPACE(json[-1]))
+  {
+    json--;
+  }
+
+  /* The parser allows a comma after the last element */
+  return json == state->json || json[-1] == ',' ? count : count + 1;
+}
+
+/*
+Arrays of numbers don't need the prescan: the counting pass counts numbers as
+it checks them, and the deserializing pass only counts commas before parsing
+the numbers right into the elements.
+*/
+static void dejson_parse_numbers(dejson_state_t* state, dejson_array_t* array, size_t element_size, size_t element_alignment, uint8_t type)
+{
+  uint64_t dummy;
+  uint8_t* elements = (uint8_t*)&dummy;
+  size_t step = 0, count = 0;
+
+  state->json++;
+  dejson_skip_spaces(state);
+
+  if (!state->counting)
+  {
+    count = dejson_count_numbers(state);
+    elements = (uint8_t*)dejson_alloc(state, element_size * count, element_alignment);
+    step = element_size;
+
+    if (state->error != DEJSON_OK)
+    {
+      return;
+    }
+
+    array->elements = elements;
+    array->count = count;
+    array->element_size = element_size;
+  }
+
+  while (*state->json != ']')
+  {
+    dejson_parse_native(state, (void*)elements, type);
+    dejson_skip_spaces(state);
+
+    elements += step;
+    count++;
+
+    if (*state->json != ',')
+    {
+      break;
+    }
+
+    state->json++;
+    dejson_skip_spaces(state);
+  }
+
+  if (*state->json != ']')
+  {
+    dejson_fail(state, DEJSON_UNTERMINATED_ARRAY);
+    return;
+  }
+
+  state->json++;
+
+  if (state->counting)
+  {
+    dejson_alloc(state, element_size * count, element_alignment);
+  }
+}
+
+static void dejson_parse_array(dejson_state_t* state, void* value, size_t element_size, size_t element_alignment, const dejson_record_field_meta_t* field)
+{
+  if (*state->json != '[')
+  {
+    dejson_fail(state, DEJSON_INVALID_VALUE);
+    return;
+  }
+
+  if (field->type <= DEJSON_TYPE_DOUBLE && (field->flags & (DEJSON_FLAG_QUOTED | DEJSON_FLAG_CONVERTED)) == 0)
+  {
+    dejson_parse_numbers(state, (dejson_array_t*)value, element_size, element_alignment, field->type);
+    return;
+  }
+
+  const uint8_t* save = state->json;
+  size_t count = state->counting != DEJSON_VALIDATING ? dejson_skip_array(state) : 0;
+
+  /* The prescan enters and leaves on its own, so the level is only counted once */
+  if (state->error != DEJSON_OK || !dejson_enter(state))
+  {
+    return;
+  }
+
+  state->json = save + 1;
+
+  uint8_t* elements = (uint8_t*)dejson_alloc(state, element_size * count, element_alignment);
+  
+  dejson_array_t* array = (dejson_array_t*)value;
+
+  if (!state->counting)
+  {
+    array->elements = elements;
+    array->count = count;
+    array->element_size = element_size;
+  }
+
+  dejson_indexed_array_t* index = NULL;
+
+  if ((field->flags & DEJSON_FLAG_INDEXED) != 0)
+  {
+    const dejson_record_field_meta_t* key = dejson_index_key(state, field);
+
+    /* Keep the load factor at or below 0.5 so probe sequences stay short */
+    size_t capacity = 1;
+
+    while (capacity < count * 2)
+    {
+      capacity *= 2;
+    }
+
+    uint32_t* slots = (uint32_t*)dejson_alloc(state, capacity * sizeof(uint32_t), DEJSON_ALIGNOF(uint32_t));
+
+    if (!state->counting)
+    {
+      memset((void*)slots, 0, capacity * sizeof(uint32_t));
+
+      index = (dejson_indexed_array_t*)value;
+      index->slots = slots;
+      index->capacity = capacity;
+      index->key_offset = key->offset;
+      index->key_type = key->type;
+    }
+  }
+
+  dejson_skip_spaces(state);
+
+  dejson_record_field_meta_t field_scalar = *field;
+  field_scalar.flags &= ~(DEJSON_FLAG_ARRAY | DEJSON_FLAG_INDEXED);
+
+  while (*state->json != ']')
+  {
+    dejson_parse_value(state, (void*)elements, &field_scalar);
+    dejson_skip_spaces(state);
+
+    if (index != NULL && state->error == DEJSON_OK)
+    {
+      /* Index the element while it's still hot, the first one wins on duplicated keys */
+      const void* key = (const void*)(elements + index->key_offset);
+
+      if (index->key_type != DEJSON_TYPE_STRING || *(const char* const*)key != NULL)
+      {
+        uint32_t* slot = dejson_index_slot(index, key, dejson_index_hash(key, index->key_type));
+
+        if (*slot == 0)
+        {
+          *slot = (elements - (uint8_t*)index->elements) / element_size + 1;
+        }
+      }
+    }
+
+    elements += element_size;
+    
+    if (*state->json != ',')
+    {
+      break;
+    }
+
+    state->json++;
+    dejson_skip_spaces(state);
+  }
+
+  if (*state->json != ']')
+  {
+    dejson_fail(state, DEJSON_UNTERMINATED_ARRAY);
+    return;
+  }
+
+  state->depth--;
+  state->json++;
+}
+
+static void dejson_parse_map(dejson_state_t* state, void* value, size_t element_size, size_t element_alignment, const dejson_record_field_meta_t* field)
+{
+  if (*state->json != '{')
+  {
+    dejson_fail(state, DEJSON_INVALID_VALUE);
+    return;
+  }
+
+  const uint8_t* save = state->json;
+  size_t count = state->counting != DEJSON_VALIDATING ? dejson_skip_object(state) : 0;
+
+  /* The prescan enters and leaves on its own, so the level is only counted once */
+  if (state->error != DEJSON_OK || !dejson_enter(state))
+  {
+    return;
+  }
+
+  state->json = save + 1;
+
+  /* Keep the load factor at or below 0.5 so probe sequences stay short */
+  size_t capacity = 1;
+
+  while (capacity < count * 2)
+  {
+    capacity *= 2;
+  }
+
+  size_t entry_alignment = DEJSON_ALIGNOF(dejson_map_entry_t);
+
+  if (element_alignment > entry_alignment)
+  {
+    entry_alignment = element_alignment;
+  }
+
+  size_t value_offset = (sizeof(dejson_map_entry_t) + element_alignment - 1) & ~(element_alignment - 1);
+  size_t entry_size = (value_offset + element_size + entry_alignment - 1) & ~(entry_alignment - 1);
+
+  uint8_t* entries = (uint8_t*)dejson_alloc(state, entry_size * count, entry_alignment);
+  uint32_t* slots = (uint32_t*)dejson_alloc(state, capacity * sizeof(uint32_t), DEJSON_ALIGNOF(uint32_t));
+
+  dejson_map_t* map = (dejson_map_t*)value;
+
+  if (!state->counting)
+  {
+    memset((void*)slots, 0, capacity * sizeof(uint32_t));
+
+    map->entries = entries;
+    map->slots = slots;
+    map->count = 0;
+    map->capacity = capacity;
+    map->entry_size = entry_size;
+    map->value_offset = value_offset;
+    map->room = count;
+  }
+
+  dejson_skip_spaces(state);
+
+  dejson_record_field_meta_t field_scalar = *field;
+  field_scalar.flags &= ~DEJSON_FLAG_MAP;
+
+  while (*state->json != '}')
+  {
+    if (*state->json != '"')
+    {
+      dejson_fail(state, DEJSON_MISSING_KEY);
+      return;
+    }
+
+    /* Keys may contain \u0000, so their length comes from decoding them */
+    dejson_string_t key;
+    size_t length = dejson_get_string(state, &key);
+    dejson_skip_spaces(state);
+
+    if (*state->json != ':')
+    {
+      dejson_fail(state, DEJSON_MISSING_VALUE);
+      return;
+    }
+
+    state->json++;
+    dejson_skip_spaces(state);
+
+    /* In counting mode nothing is written, so the first value is as good as any */
+    void* element = (void*)(entries + value_offset);
+
+    if (!state->counting)
+    {
+      uint32_t hash = dejson_hash((const uint8_t*)key.chars, length);
+      uint32_t* slot = dejson_map_slot(map, key.chars, length, hash);
+
+      if (*slot == 0)
+      {
+        dejson_map_entry_t* entry = DEJSON_GET_ENTRY(*map, map->count);
+        entry->key = key;
+        entry->hash = hash;
+        entry->length = length;
+        *slot = ++map->count;
+      }
+
+      /* Duplicated keys keep their first entry, and the last value wins */
+      element = DEJSON_GET_VALUE(*map, (*slot - 1));
+    }
+
+    dejson_parse_value(state, element, &field_scalar);
+    dejson_skip_spaces(state);
+
+    if (*state->json != ',')
+    {
+      break;
+    }
+
+    state->json++;
+    dejson_skip_spaces(state);
+  }
+
+  if (*state->json != '}')
+  {
+    dejson_fail(state, DEJSON_UNTERMINATED_OBJECT);
+    return;
+  }
+
+  state->depth--;
+  state->json++;
+}
+
+static void dejson_parse_value(dejson_state_t* state, void* value, const dejson_record_field_meta_t* field)
+{
+  const dejson_record_meta_t* meta;
+  const dejson_enum_meta_t* enum_meta = NULL;
+
+  if ((field->flags & (DEJSON_FLAG_ARRAY | DEJSON_FLAG_POINTER | DEJSON_FLAG_MAP)) == 0)
+  {
+    if (field->type == DEJSON_TYPE_ENUM)
+    {
+      dejson_parse_enum(state, value, dejson_get_enum(state, field->type_hash));
+    }
+    else if (field->type != DEJSON_TYPE_RECORD)
+    {
+      char dummy[64];
+
+      if (state->counting)
+      {
+        value = (void*)dummy;
+      }
+
+      dejson_parse_scalar(state, value, field);
+    }
+    else
+    {
+      meta = dejson_resolve_record(field->type_hash);
+      
+      if (meta == NULL)
+      {
+        dejson_fail(state, DEJSON_UNKOWN_RECORD);
+        return;
+      }
+
+      dejson_parse_object(state, value, meta);
+    }
+
+    return;
+  }
+
+  size_t size, alignment;
+
+  if (field->type == DEJSON_TYPE_ENUM)
+  {
+    enum_meta = dejson_get_enum(state, field->type_hash);
+    size = alignment = enum_meta->size;
+  }
+  else if (field->type != DEJSON_TYPE_RECORD)
+  {
+    unsigned ndx = field->type * 2;
+    size = dejson_type_info[ndx];
+    alignment = dejson_type_info[ndx + 1];
+  }
+  else /* field->type == DEJSON_TYPE_RECORD */
+  {
+    meta = dejson_resolve_record(field->type_hash);
+    
+    if (meta == NULL)
+    {
+      dejson_fail(state, DEJSON_UNKOWN_RECORD);
+      return;
+    }
+
+    size = meta->size;
+    alignment = meta->alignment;
+  }
+
+  if ((field->flags & DEJSON_FLAG_ARRAY) != 0)
+  {
+    dejson_parse_array(state, value, size, alignment, field);
+    return;
+  }
+
+  if ((field->flags & DEJSON_FLAG_MAP) != 0)
+  {
+    dejson_parse_map(state, value, size, alignment, field);
+    return;
+  }
+
+  // (field->flags & DEJSON_FLAG_POINTER) != 0
+
+  const uint8_t* json = state->json;
+
+  if (json[0] == 'n' && json[1] == 'u' && json[2] == 'l' && json[3] == 'l' && !isalpha(json[4]))
+  {
+    if (!state->counting)
+    {
+      *(void**)value = NULL;
+    }
+
+    state->json += 4;
+    return;
+  }
+
+  void* pointer = dejson_alloc(state, size, alignment);
+
+  if (!state->counting)
+  {
+    *(void**)value = pointer;
+  }
+
+  value = pointer;
+
+  if (enum_meta != NULL)
+  {
+    dejson_parse_enum(state, value, enum_meta);
+  }
+  else if (field->type != DEJSON_TYPE_RECORD)
+  {
+    char dummy[64];
+
+    /* The pointer isn't real while counting */
+    if (state->counting)
+    {
+      value = (void*)dummy;
+    }
+
+    dejson_parse_scalar(state, value, field);
+  }
+  else
+  {
+    dejson_parse_object(state, value, meta);
+  }
+}
+
+static const dejson_record_field_meta_t* dejson_parse_key(dejson_state_t* state, const dejson_record_meta_t* meta)
+{
+  if (*state->json != '"')
+  {
+    dejson_fail(state, DEJSON_MISSING_KEY);
+    return NULL;
+  }
+
+  const uint8_t* key = ++state->json;
+  const uint8_t* quote = key;
+
+  for (;;)
+  {
+    quote = dejson_scan_string(quote, 1);
+
+    if (*quote == '"')
+    {
+      break;
+    }
+    else if (*quote == 0)
+    {
+      dejson_fail(state, DEJSON_UNTERMINATED_KEY);
+      return NULL;
+    }
+    else if (*quote == '\\')
+    {
+      /* Escapes in keys are validated but not decoded, the hash is over the raw characters */
+      uint32_t utf32;
+
+      if (quote[1] == 'u')
+      {
+        quote = dejson_get_unicode(state, quote + 2, &utf32);
+      }
+      else if (quote[1] != 0 && strchr("\"\\/bfnrt", quote[1]) != NULL)
+      {
+        quote += 2;
+      }
+      else
+      {
+        dejson_fail(state, DEJSON_INVALID_ESCAPE);
+        return NULL;
+      }
+    }
+    else
+    {
+      size_t length = dejson_utf8_length(quote);
+
+      if (length == 0)
+      {
+        dejson_fail(state, DEJSON_INVALID_UTF8);
+        return NULL;
+      }
+
+      quote += length;
+    }
+  }
+
+  state->json = quote + 1;
+  uint32_t hash = dejson_hash(key, quote - key);
+
+  unsigned i;
+  const dejson_record_field_meta_t* field;
   
-  const dejson_record_meta_t* meta;
+  for (i = 0, field = meta->fields; i < meta->num_fields; i++, field++)
+  {
+    if (field->name_hash == hash)
+    {
+      break;
+    }
+  }
+
+  dejson_skip_spaces(state);
+
+  if (*state->json != ':')
+  {
+    dejson_fail(state, DEJSON_MISSING_VALUE);
+    return NULL;
+  }
+
+  state->json++;
+  dejson_skip_spaces(state);
+
+  return i != meta->num_fields ? field : NULL;
+}
+
+/* presence is 0 for missing, 1 for present and 2 for null, both bits are in the same byte */
+static void dejson_set_presence(dejson_state_t* state, void* record, const dejson_record_meta_t* meta, const dejson_record_field_meta_t* field, unsigned presence)
+{
+  if (!state->counting)
+  {
+    uint8_t* bits = (uint8_t*)record + meta->presence + (field->presence >> 3);
+    unsigned shift = field->presence & 7;
+    *bits = (*bits & ~(3U << shift)) | (presence << shift);
+  }
+}
+
+static void dejson_parse_optional(dejson_state_t* state, void* record, const dejson_record_meta_t* meta, const dejson_record_field_meta_t* field)
+{
+  const uint8_t* json = state->json;
+  void* value = (void*)((uint8_t*)record + field->offset);
+
+  if (json[0] == 'n' && json[1] == 'u' && json[2] == 'l' && json[3] == 'l' && !isalpha(json[4]))
+  {
+    state->json += 4;
+
+    if (!state->counting)
+    {
+      size_t size;
+
+      /* Zero the value again in case the key is repeated */
+      if (field->type == DEJSON_TYPE_ENUM)
+      {
+        size = dejson_get_enum(state, field->type_hash)->size;
+      }
+      else if (field->type == DEJSON_TYPE_RECORD)
+      {
+        const dejson_record_meta_t* record_meta = dejson_resolve_record(field->type_hash);
+
+        if (record_meta == NULL)
+        {
+          dejson_fail(state, DEJSON_UNKOWN_RECORD);
+          return;
+        }
+
+        size = record_meta->size;
+      }
+      else
+      {
+        size = dejson_type_info[field->type * 2];
+      }
+
+      memset(value, 0, size);
+    }
+
+    dejson_set_presence(state, record, meta, field, 2);
+    return;
+  }
+
+  dejson_parse_value(state, value, field);
+  dejson_set_presence(state, record, meta, field, 1);
+}
+
+static void dejson_parse_object(dejson_state_t* state, void* record, const dejson_record_meta_t* meta)
+{
+  if (*state->json != '{')
+  {
+    dejson_fail(state, DEJSON_INVALID_VALUE);
+    return;
+  }
+
+  if (!dejson_enter(state))
+  {
+    return;
+  }
+
+  if (!state->counting)
+  {
+    memset((void*)record, 0, meta->size);
+  }
+
+  state->json++;
+  dejson_skip_spaces(state);
+  
+  while (*state->json != '}')
+  {
+    const dejson_record_field_meta_t* field = dejson_parse_key(state, meta);
+
+    if (field != NULL && (field->flags & DEJSON_FLAG_OPTIONAL) != 0)
+    {
+      dejson_parse_optional(state, record, meta, field);
+    }
+    else if (field != NULL)
+    {
+      dejson_parse_value(state, (void*)((uint8_t*)record + field->offset), field);
+    }
+    else
+    {
+      dejson_skip_value(state);
+    }
+
+    dejson_skip_spaces(state);
+
+    if (*state->json != ',')
+    {
+      break;
+    }
+
+    state->json++;
+    dejson_skip_spaces(state);
+  }
+
+  if (*state->json != '}')
+  {
+    dejson_fail(state, DEJSON_UNTERMINATED_OBJECT);
+    return;
+  }
+
+  state->depth--;
+  state->json++;
+}
+
+static void dejson_patch_value(dejson_state_t*, void*, const dejson_record_field_meta_t*, int);
+
+/*
+A patch is applied as if it had been parsed into a dictionary first, so when a
+key is repeated in an object only its last value counts. Applying each key once
+is also what keeps dejson_get_patch_size exact, since the counting pass can't
+see what earlier values did. repeated is a Bloom filter with the keys that may
+appear more than once, so only those are looked for in the rest of the object.
+Records compare keys raw, as dejson_parse_key does, and maps decoded.
+*/
+typedef struct
+{
+  uint64_t repeated[4];
+  size_t   count;
+  int      decoded;
+}
+dejson_keys_t;
+
+#define DEJSON_KEY_BIT(hash) ((uint32_t)((hash) * 0x9e3779b1U) >> 24)
+
+static uint32_t dejson_skip_key(dejson_state_t* state, int decoded, size_t* length)
+{
+  const uint8_t* key = state->json;
+
+  if (*key != '"')
+  {
+    dejson_fail(state, DEJSON_MISSING_KEY);
+    return 0;
+  }
+
+  dejson_skip_string(state);
+
+  if (state->error != DEJSON_OK)
+  {
+    return 0;
+  }
+  else if (decoded)
+  {
+    return dejson_hash_string(state, key, length);
+  }
+
+  *length = state->json - key - 2;
+  return dejson_hash(key + 1, *length);
+}
+
+/* Checks the object at state->json, counting its keys, and leaves state->json where it was */
+static void dejson_scan_keys(dejson_state_t* state, dejson_keys_t* keys)
+{
+  const uint8_t* save = state->json;
+  uint64_t seen[4] = {0, 0, 0, 0};
+
+  memset((void*)keys->repeated, 0, sizeof(keys->repeated));
+  keys->count = 0;
+
+  state->json++;
+  dejson_skip_spaces(state);
+
+  while (*state->json != '}')
+  {
+    size_t length;
+    uint32_t bit = DEJSON_KEY_BIT(dejson_skip_key(state, keys->decoded, &length));
+    dejson_skip_spaces(state);
+
+    if (*state->json != ':')
+    {
+      dejson_fail(state, DEJSON_MISSING_VALUE);
+      return;
+    }
+
+    state->json++;
+    dejson_skip_spaces(state);
+    dejson_skip_value(state);
+
+    keys->repeated[bit >> 6] |= seen[bit >> 6] & (UINT64_C(1) << (bit & 63));
+    seen[bit >> 6] |= UINT64_C(1) << (bit & 63);
+    keys->count++;
+
+    if (*state->json != ',')
+    {
+      break;
+    }
+
+    state->json++;
+    dejson_skip_spaces(state);
+  }
+
+  if (*state->json != '}')
+  {
+    dejson_fail(state, DEJSON_UNTERMINATED_OBJECT);
+    return;
+  }
+
+  state->json = save;
+}
+
+/* Compares the decoded contents of two valid strings */
+static int dejson_keys_equal(dejson_state_t* state, const uint8_t* a, const uint8_t* b)
+{
+  uint8_t utf8_a[4], utf8_b[4];
+  size_t i = 0, j = 0, n = 0, m = 0;
+
+  for (a++, b++;;)
+  {
+    if (i == n)
+    {
+      if (*a == '"')
+      {
+        return *b == '"' && j == m;
+      }
+      else if (*a == '\\')
+      {
+        a = dejson_decode_escape(state, a, utf8_a, &n);
+      }
+      else
+      {
+        utf8_a[0] = *a++;
+        n = 1;
+      }
+
+      i = 0;
+    }
+
+    if (j == m)
+    {
+      if (*b == '"')
+      {
+        return 0;
+      }
+      else if (*b == '\\')
+      {
+        b = dejson_decode_escape(state, b, utf8_b, &m);
+      }
+      else
+      {
+        utf8_b[0] = *b++;
+        m = 1;
+      }
+
+      j = 0;
+    }
+
+    if (i == n || j == m || utf8_a[i++] != utf8_b[j++])
+    {
+      return 0;
+    }
+  }
+}
+
+/* Whether the key at key, with its value at state->json, appears again later in the object */
+static int dejson_is_repeated(dejson_state_t* state, const dejson_keys_t* keys, const uint8_t* key)
+{
+  const uint8_t* save = state->json;
+  size_t length, other_length;
+
+  state->json = key;
+  uint32_t hash = dejson_skip_key(state, keys->decoded, &length);
+  uint32_t bit = DEJSON_KEY_BIT(hash);
+  int repeated = 0;
+
+  if (((keys->repeated[bit >> 6] >> (bit & 63)) & 1) != 0)
+  {
+    /* The object was already checked by dejson_scan_keys */
+    state->json = save;
+    dejson_skip_value(state);
+
+    while (!repeated && *state->json == ',')
+    {
+      state->json++;
+      dejson_skip_spaces(state);
+
+      const uint8_t* other = state->json;
+      uint32_t other_hash = dejson_skip_key(state, keys->decoded, &other_length);
+
+      repeated = other_hash == hash && (!keys->decoded || (other_length == length && dejson_keys_equal(state, key, other)));
+
+      dejson_skip_spaces(state);
+      state->json++;
+      dejson_skip_spaces(state);
+      dejson_skip_value(state);
+    }
+  }
+
+  state->json = save;
+  return repeated;
+}
+
+/*
+Merges the patch object at state->json into record as per RFC 7386. When fresh
+is set the record was just allocated and is known to be zeroed, so it isn't
+read; this is what allows the counting pass to follow new allocations.
+*/
+static void dejson_patch_object(dejson_state_t* state, void* record, const dejson_record_meta_t* meta, int fresh)
+{
+  if (*state->json != '{')
+  {
+    dejson_fail(state, DEJSON_INVALID_VALUE);
+    return;
+  }
+
+  if (!dejson_enter(state))
+  {
+    return;
+  }
 
-  if ((field->flags & (DEJSON_FLAG_ARRAY | DEJSON_FLAG_POINTER)) == 0)
+  dejson_keys_t keys;
+  keys.decoded = 0;
+  dejson_scan_keys(state, &keys);
+
+  state->json++;
+  dejson_skip_spaces(state);
+  
+  while (*state->json != '}')
   {
-    if (field->type != DEJSON_TYPE_RECORD)
+    const uint8_t* key = state->json;
+    const dejson_record_field_meta_t* field = dejson_parse_key(state, meta);
+
+    if (field != NULL && !dejson_is_repeated(state, &keys, key))
     {
-      char dummy[64];
+      /* null removes optional fields, so they become missing rather than null */
+      unsigned presence = *state->json != 'n';
+      dejson_patch_value(state, (void*)((uint8_t*)record + field->offset), field, fresh);
 
-      if (state->counting)
+      if ((field->flags & DEJSON_FLAG_OPTIONAL) != 0)
       {
-        value = (void*)dummy;
+        dejson_set_presence(state, record, meta, field, presence);
       }
+    }
+    else
+    {
+      dejson_skip_value(state);
+    }
+
+    dejson_skip_spaces(state);
+
+    if (*state->json != ',')
+    {
+      break;
+    }
+
+    state->json++;
+    dejson_skip_spaces(state);
+  }
+
+  if (*state->json != '}')
+  {
+    dejson_fail(state, DEJSON_UNTERMINATED_OBJECT);
+    return;
+  }
+
+  state->depth--;
+  state->json++;
+}
+
+/* Returns the slot with the key at key, or the empty slot where it would go, or NULL if the map has no slots */
+static uint32_t* dejson_patch_lookup(dejson_state_t* state, const dejson_map_t* map, const uint8_t* key, size_t length, uint32_t hash)
+{
+  if (map->capacity == 0)
+  {
+    return NULL;
+  }
+
+  uint32_t mask = map->capacity - 1;
+  uint32_t ndx = (hash ^ (hash >> 16)) & mask;
+
+  for (;;)
+  {
+    uint32_t* slot = map->slots + ndx;
+
+    if (*slot == 0)
+    {
+      return slot;
+    }
+
+    const dejson_map_entry_t* entry = DEJSON_GET_ENTRY(*map, (*slot - 1));
+
+    if (entry->hash == hash && entry->length == length && dejson_string_equals(state, key, entry->key.chars))
+    {
+      return slot;
+    }
+
+    ndx = (ndx + 1) & mask;
+  }
+}
+
+/*
+Grows the map to room for count entries, and at least twice as many as before
+so that adding keys one patch at a time is amortized. The counting pass only
+follows the sizes, the old entries are copied and rehashed when deserializing.
+*/
+static void dejson_grow_map(dejson_state_t* state, dejson_map_t* map, size_t entry_size, size_t entry_alignment, size_t count)
+{
+  if (count < (size_t)map->room * 2)
+  {
+    count = (size_t)map->room * 2;
+  }
+
+  /* Keep the load factor at or below 0.5 so probe sequences stay short */
+  size_t capacity = 1;
+
+  while (capacity < count * 2)
+  {
+    capacity *= 2;
+  }
+
+  uint8_t* entries = (uint8_t*)dejson_alloc(state, entry_size * (capacity / 2), entry_alignment);
+  uint32_t* slots = (uint32_t*)dejson_alloc(state, capacity * sizeof(uint32_t), DEJSON_ALIGNOF(uint32_t));
+
+  if (!state->counting)
+  {
+    if (map->count != 0)
+    {
+      memcpy((void*)entries, map->entries, map->count * entry_size);
+    }
+
+    memset((void*)slots, 0, capacity * sizeof(uint32_t));
+  }
+
+  map->entries = entries;
+  map->slots = slots;
+  map->capacity = capacity;
+  map->room = capacity / 2;
+
+  if (!state->counting)
+  {
+    uint32_t i;
+
+    for (i = 0; i < map->count; i++)
+    {
+      const dejson_map_entry_t* entry = DEJSON_GET_ENTRY(*map, i);
+      *dejson_map_slot(map, entry->key.chars, entry->length, entry->hash) = i + 1;
+    }
+  }
+}
+
+/* Frees slot by shifting back the entries after it, and moves the last entry in place of the removed one */
+static void dejson_remove_entry(dejson_map_t* map, uint32_t* slot)
+{
+  uint32_t mask = map->capacity - 1;
+  uint32_t hole = slot - map->slots;
+  uint32_t ndx = *slot - 1;
+  uint32_t i = hole;
+
+  for (;;)
+  {
+    i = (i + 1) & mask;
+
+    if (map->slots[i] == 0)
+    {
+      break;
+    }
+
+    const dejson_map_entry_t* entry = DEJSON_GET_ENTRY(*map, (map->slots[i] - 1));
+    uint32_t home = (entry->hash ^ (entry->hash >> 16)) & mask;
+
+    /* The entry can fill the hole if that's no closer to its home than where it is */
+    if (((i - home) & mask) >= ((i - hole) & mask))
+    {
+      map->slots[hole] = map->slots[i];
+      hole = i;
+    }
+  }
+
+  map->slots[hole] = 0;
+  map->count--;
+
+  if (ndx != map->count)
+  {
+    dejson_map_entry_t* last = DEJSON_GET_ENTRY(*map, map->count);
+    *dejson_map_slot(map, last->key.chars, last->length, last->hash) = ndx + 1;
+    memcpy((void*)DEJSON_GET_ENTRY(*map, ndx), (const void*)last, map->entry_size);
+  }
+}
+
+/*
+Patches the map in place: values of existing keys are merged where they are,
+removed entries are replaced by the last one, and new keys are appended, only
+growing the map when it's out of room. The counting pass can't change the map,
+so it looks keys up in the original one and just follows count and room, which
+is exact since each key is applied once.
+*/
+static void dejson_patch_map(dejson_state_t* state, void* value, size_t element_size, size_t element_alignment, const dejson_record_field_meta_t* field, int fresh)
+{
+  if (!dejson_enter(state))
+  {
+    return;
+  }
+
+  dejson_keys_t keys;
+  keys.decoded = 1;
+  dejson_scan_keys(state, &keys);
+
+  if (state->error != DEJSON_OK)
+  {
+    return;
+  }
+
+  dejson_map_t map;
+
+  if (fresh)
+  {
+    memset((void*)&map, 0, sizeof(map));
+  }
+  else
+  {
+    map = *(const dejson_map_t*)value;
+  }
+
+  const dejson_map_t original = map;
+  size_t pending = keys.count;
+
+  size_t entry_alignment = DEJSON_ALIGNOF(dejson_map_entry_t);
+
+  if (element_alignment > entry_alignment)
+  {
+    entry_alignment = element_alignment;
+  }
+
+  size_t value_offset = (sizeof(dejson_map_entry_t) + element_alignment - 1) & ~(element_alignment - 1);
+  size_t entry_size = (value_offset + element_size + entry_alignment - 1) & ~(entry_alignment - 1);
+
+  map.entry_size = entry_size;
+  map.value_offset = value_offset;
+
+  state->json++;
+  dejson_skip_spaces(state);
+
+  dejson_record_field_meta_t field_scalar = *field;
+  field_scalar.flags &= ~DEJSON_FLAG_MAP;
+
+  while (*state->json != '}')
+  {
+    const uint8_t* key = state->json;
+    size_t length;
+    uint32_t hash = dejson_hash_string(state, key, &length);
+    uint32_t* slot = dejson_patch_lookup(state, state->counting ? &original : &map, key, length, hash);
+
+    dejson_skip_string(state);
+    dejson_skip_spaces(state);
+
+    if (*state->json != ':')
+    {
+      dejson_fail(state, DEJSON_MISSING_VALUE);
+      return;
+    }
+
+    state->json++;
+    dejson_skip_spaces(state);
+
+    const uint8_t* json = state->json;
+    int found = slot != NULL && *slot != 0;
+
+    if (dejson_is_repeated(state, &keys, key))
+    {
+      dejson_skip_value(state);
+    }
+    else if (json[0] == 'n' && json[1] == 'u' && json[2] == 'l' && json[3] == 'l' && !isalpha(json[4]))
+    {
+      state->json += 4;
 
-      dejson_parsers[field->type](state, value);
+      if (found && !state->counting)
+      {
+        dejson_remove_entry(&map, slot);
+      }
+      else if (found)
+      {
+        map.count--;
+      }
+    }
+    else if (found)
+    {
+      const dejson_map_t* where = state->counting ? &original : &map;
+      dejson_patch_value(state, DEJSON_GET_VALUE(*where, (*slot - 1)), &field_scalar, 0);
     }
     else
     {
-      meta = dejson_resolve_record(field->type_hash);
-      
-      if (meta == NULL)
+      if (map.count == map.room)
+      {
+        dejson_grow_map(state, &map, entry_size, entry_alignment, map.count + pending);
+      }
+
+      dejson_string_t chars;
+      state->json = key;
+      dejson_get_string(state, &chars);
+
+      if (state->error != DEJSON_OK)
+      {
+        return;
+      }
+
+      state->json = json;
+
+      if (!state->counting)
+      {
+        dejson_map_entry_t* entry = DEJSON_GET_ENTRY(map, map.count);
+        entry->key = chars;
+        entry->hash = hash;
+        entry->length = length;
+        *dejson_map_slot(&map, chars.chars, length, hash) = map.count + 1;
+        memset(DEJSON_GET_VALUE(map, map.count), 0, element_size);
+      }
+
+      map.count++;
+      dejson_patch_value(state, DEJSON_GET_VALUE(map, (map.count - 1)), &field_scalar, 1);
+    }
+
+    pending--;
+    dejson_skip_spaces(state);
+
+    if (*state->json != ',')
+    {
+      break;
+    }
+
+    state->json++;
+    dejson_skip_spaces(state);
+  }
+
+  if (*state->json != '}')
+  {
+    dejson_fail(state, DEJSON_UNTERMINATED_OBJECT);
+    return;
+  }
+
+  state->depth--;
+  state->json++;
+
+  if (!state->counting)
+  {
+    *(dejson_map_t*)value = map;
+  }
+}
+
+static void dejson_patch_value(dejson_state_t* state, void* value, const dejson_record_field_meta_t* field, int fresh)
+{
+  const dejson_record_meta_t* meta = NULL;
+  size_t size, alignment;
+
+  if (field->type == DEJSON_TYPE_ENUM)
+  {
+    size = alignment = dejson_get_enum(state, field->type_hash)->size;
+  }
+  else if (field->type != DEJSON_TYPE_RECORD)
+  {
+    unsigned ndx = field->type * 2;
+    size = dejson_type_info[ndx];
+    alignment = dejson_type_info[ndx + 1];
+  }
+  else
+  {
+    meta = dejson_resolve_record(field->type_hash);
+
+    if (meta == NULL)
+    {
+      dejson_fail(state, DEJSON_UNKOWN_RECORD);
+      return;
+    }
+
+    size = meta->size;
+    alignment = meta->alignment;
+  }
+
+  const uint8_t* json = state->json;
+
+  if (json[0] == 'n' && json[1] == 'u' && json[2] == 'l' && json[3] == 'l' && !isalpha(json[4]))
+  {
+    /* null removes the value, which for dejson means zeroing it */
+    state->json += 4;
+
+    if (!state->counting)
+    {
+      if ((field->flags & DEJSON_FLAG_POINTER) != 0)
+      {
+        size = sizeof(void*);
+      }
+      else if ((field->flags & DEJSON_FLAG_INDEXED) != 0)
+      {
+        size = sizeof(dejson_indexed_array_t);
+      }
+      else if ((field->flags & DEJSON_FLAG_ARRAY) != 0)
+      {
+        size = sizeof(dejson_array_t);
+      }
+      else if ((field->flags & DEJSON_FLAG_MAP) != 0)
+      {
+        size = sizeof(dejson_map_t);
+      }
+
+      memset(value, 0, size);
+    }
+
+    return;
+  }
+
+  if (*json != '{' || (field->flags & DEJSON_FLAG_ARRAY) != 0 || (meta == NULL && (field->flags & DEJSON_FLAG_MAP) == 0))
+  {
+    /* Everything that isn't merged, including arrays, is replaced */
+    dejson_parse_value(state, value, field);
+    return;
+  }
+
+  if ((field->flags & DEJSON_FLAG_MAP) != 0)
+  {
+    dejson_patch_map(state, value, size, alignment, field, fresh);
+    return;
+  }
+
+  if ((field->flags & DEJSON_FLAG_POINTER) != 0)
+  {
+    void* pointer = fresh ? NULL : *(void**)value;
+
+    if (pointer == NULL)
+    {
+      pointer = dejson_alloc(state, size, alignment);
+
+      if (!state->counting)
       {
-        longjmp(state->rollback, DEJSON_UNKOWN_RECORD);
+        *(void**)value = pointer;
+        memset(pointer, 0, size);
       }
 
-      dejson_parse_object(state, value, meta);
+      fresh = 1;
     }
 
-    return;
+    value = pointer;
   }
 
-  size_t size, alignment;
+  dejson_patch_object(state, value, meta, fresh);
+}
 
-  if (field->type != DEJSON_TYPE_RECORD)
+/*
+With span, json is ignored and the span is parsed from a NUL-terminated copy,
+kept in the buffer right after the root record so that json fields can point
+into it. The counting pass parses a temporary copy instead.
+*/
+static int dejson_execute(void* buffer, const dejson_record_meta_t* meta, const uint8_t* json, const dejson_json_t* span, dejson_feed_t* feed, int counting)
+{
+  if (!meta)
   {
-    unsigned ndx = field->type * 2;
-    size = dejson_type_info[ndx];
-    alignment = dejson_type_info[ndx + 1];
+    return DEJSON_UNKOWN_RECORD;
   }
-  else /* field->type == DEJSON_TYPE_RECORD */
+
+  dejson_state_t state;
+
+  state.json = json;
+  state.buffer = counting ? 0 : (uintptr_t)buffer;
+  state.limit = UINTPTR_MAX;
+  state.feed = feed;
+  state.counting = counting;
+  state.error = DEJSON_OK;
+  state.depth = 0;
+
+  void* record = dejson_alloc(&state, meta->size, meta->alignment);
+  uint8_t* copy = NULL;
+
+  if (span != NULL)
   {
-    meta = dejson_resolve_record(field->type_hash);
-    
-    if (meta == NULL)
+    copy = (uint8_t*)dejson_alloc(&state, span->length + 1, 1);
+
+    if (counting)
     {
-      longjmp(state->rollback, DEJSON_UNKOWN_RECORD);
+      copy = (uint8_t*)malloc(span->length + 1);
+
+      if (copy == NULL)
+      {
+        return DEJSON_OUT_OF_MEMORY;
+      }
     }
 
-    size = meta->size;
-    alignment = meta->alignment;
+    memcpy((void*)copy, (const void*)span->chars, span->length);
+    copy[span->length] = 0;
+    state.json = copy;
   }
+  
+  dejson_skip_spaces(&state);
+  dejson_parse_object(&state, record, meta);
+  dejson_skip_spaces(&state);
 
-  if ((field->flags & DEJSON_FLAG_ARRAY) != 0)
+  /* A NUL inside the span would end the document early */
+  int res = state.error;
+
+  if (res == DEJSON_OK && (*state.json != 0 || (span != NULL && state.json != copy + span->length)))
   {
-    dejson_parse_array(state, value, size, alignment, field);
-    return;
+    res = DEJSON_EOF_EXPECTED;
   }
 
-  // (field->flags & DEJSON_FLAG_POINTER) != 0
-
-  const uint8_t* json = state->json;
-
-  if (json[0] == 'n' && json[1] == 'u' && json[2] == 'l' && json[3] == 'l' && !isalpha(json[4]))
+  if (counting)
   {
-    if (!state->counting)
+    free((void*)copy);
+
+    if (state.error == DEJSON_OK)
     {
-      *(void**)value = NULL;
+      *(size_t*)buffer = state.buffer;
     }
-
-    state->json += 4;
-    return;
   }
 
-  void* pointer = dejson_alloc(state, size, alignment);
+  return res;
+}
 
-  if (!state->counting)
+static int dejson_execute_patch(void* root, void* buffer, size_t size, uint32_t hash, const uint8_t* json, int counting)
+{
+  const dejson_record_meta_t* meta = dejson_resolve_record(hash);
+  
+  if (!meta)
   {
-    *(void**)value = pointer;
+    return DEJSON_UNKOWN_RECORD;
   }
 
-  value = pointer;
+  dejson_state_t state;
+
+  state.json = json;
+  state.buffer = counting ? 0 : (uintptr_t)buffer;
+  state.limit = counting ? UINTPTR_MAX : (uintptr_t)buffer + size;
+  state.feed = NULL;
+  state.counting = counting;
+  state.error = DEJSON_OK;
+  state.depth = 0;
 
-  if (field->type != DEJSON_TYPE_RECORD)
+  dejson_skip_spaces(&state);
+  dejson_patch_object(&state, root, meta, 0);
+  dejson_skip_spaces(&state);
+
+  if (state.error != DEJSON_OK)
   {
-    dejson_parsers[field->type](state, value);
+    return state.error;
   }
-  else
+
+  if (counting)
   {
-    dejson_parse_object(state, value, meta);
+    *(size_t*)buffer = state.buffer;
   }
+
+  return *state.json == 0 ? DEJSON_OK : DEJSON_EOF_EXPECTED;
 }
 
-static void dejson_parse_object(dejson_state_t* state, void* record, const dejson_record_meta_t* meta)
+int dejson_deserialize(void* buffer, uint32_t hash, const uint8_t* json)
 {
-  if (*state->json != '{')
+  return dejson_execute(buffer, dejson_resolve_record(hash), json, NULL, NULL, 0);
+}
+
+int dejson_get_size(size_t* size, uint32_t hash, const uint8_t* json)
+{
+  return dejson_execute((void*)size, dejson_resolve_record(hash), json, NULL, NULL, 1);
+}
+
+int dejson_validate(uint32_t hash, const uint8_t* json, size_t length)
+{
+  size_t size;
+  const dejson_record_meta_t* meta = dejson_resolve_record(hash);
+  int res = dejson_execute((void*)&size, meta, json, NULL, NULL, DEJSON_VALIDATING);
+
+  if (res != DEJSON_OK)
   {
-    longjmp(state->rollback, DEJSON_INVALID_VALUE);
+    /*
+    Without the prescans errors can be found in a different order, so invalid
+    documents go through the counting pass to get the same error it'd return.
+    */
+    res = dejson_execute((void*)&size, meta, json, NULL, NULL, DEJSON_COUNTING);
   }
 
-  if (!state->counting)
+  /* The parser stops at the first NUL, anything after it would be ignored */
+  if (res == DEJSON_OK && memchr((const void*)json, 0, length) != NULL)
   {
-    memset((void*)record, 0, meta->size);
+    res = DEJSON_EOF_EXPECTED;
+  }
+
+  return res;
+}
+
+int dejson_deserialize_feed(void* buffer, uint32_t hash, const uint8_t* json, dejson_feed_t* feed)
+{
+  return dejson_execute(buffer, dejson_resolve_record(hash), json, NULL, feed, 0);
+}
+
+int dejson_get_size_feed(size_t* size, uint32_t hash, const uint8_t* json, dejson_feed_t* feed)
+{
+  return dejson_execute((void*)size, dejson_resolve_record(hash), json, NULL, feed, 1);
+}
+
+int dejson_deserialize_record(void* buffer, const dejson_record_meta_t* meta, const uint8_t* json, dejson_feed_t* feed)
+{
+  return dejson_execute(buffer, meta, json, NULL, feed, 0);
+}
+
+int dejson_get_record_size(size_t* size, const dejson_record_meta_t* meta, const uint8_t* json, dejson_feed_t* feed)
+{
+  return dejson_execute((void*)size, meta, json, NULL, feed, 1);
+}
+
+int dejson_deserialize_json(void* buffer, const dejson_record_meta_t* meta, const dejson_json_t* json)
+{
+  return dejson_execute(buffer, meta, NULL, json, NULL, 0);
+}
+
+int dejson_get_json_size(size_t* size, const dejson_record_meta_t* meta, const dejson_json_t* json)
+{
+  return dejson_execute((void*)size, meta, NULL, json, NULL, 1);
+}
+
+typedef struct
+{
+  const dejson_record_meta_t* meta;
+  void*                       scratch;
+  size_t                      size;
+  dejson_element_t            callback;
+  void*                       userdata;
+  size_t                      index;
+}
+dejson_walk_t;
+
+/* Returns zero when the callback stops the walk */
+static int dejson_walk_array(dejson_state_t* state, dejson_walk_t* walk)
+{
+  const dejson_record_meta_t* meta = walk->meta;
+
+  if (*state->json != '[')
+  {
+    dejson_fail(state, DEJSON_INVALID_VALUE);
+    return 1;
   }
 
   state->json++;
   dejson_skip_spaces(state);
-  
-  while (*state->json != '}')
+
+  while (*state->json != ']')
   {
-    if (*state->json != '"')
+    /* Each element is counted and then deserialized into the scratch buffer, just like a document */
+    const uint8_t* element = state->json;
+
+    state->buffer = 0;
+    state->limit = UINTPTR_MAX;
+    state->counting = DEJSON_COUNTING;
+    dejson_parse_object(state, dejson_alloc(state, meta->size, meta->alignment), meta);
+
+    if (state->error != DEJSON_OK)
     {
-      longjmp(state->rollback, DEJSON_MISSING_KEY);
+      return 1;
     }
-
-    const char* key = (const char*)++state->json;
-    const char* quote = key;
-    
-    for (;;)
+    else if (state->buffer > walk->size)
     {
-      quote = strchr(quote, '"');
-
-      if (!quote)
-      {
-        longjmp(state->rollback, DEJSON_UNTERMINATED_KEY);
-      }
-
-      if (quote[-1] != '\\')
-      {
-        break;
-      }
+      dejson_fail(state, DEJSON_OUT_OF_MEMORY);
+      return 1;
     }
 
-    state->json = (const uint8_t*)quote + 1;
-    uint32_t hash = dejson_hash((const uint8_t*)key, quote - key);
+    state->json = element;
+    state->buffer = (uintptr_t)walk->scratch;
+    state->limit = state->buffer + walk->size;
+    state->counting = DEJSON_DESERIALIZING;
 
-    unsigned i;
-    const dejson_record_field_meta_t* field;
-    
-    for (i = 0, field = meta->fields; i < meta->num_fields; i++, field++)
+    void* record = dejson_alloc(state, meta->size, meta->alignment);
+    dejson_parse_object(state, record, meta);
+
+    if (state->error != DEJSON_OK)
     {
-      if (field->name_hash == hash)
-      {
-        break;
-      }
+      return 1;
+    }
+    else if (!walk->callback(walk->userdata, record, walk->index++))
+    {
+      return 0;
     }
 
     dejson_skip_spaces(state);
 
-    if (*state->json != ':')
+    if (*state->json != ',')
     {
-      longjmp(state->rollback, DEJSON_MISSING_VALUE);
+      break;
     }
 
     state->json++;
     dejson_skip_spaces(state);
+  }
+
+  /* The rest of the document is only checked, like before the array */
+  state->counting = DEJSON_VALIDATING;
+
+  if (*state->json != ']')
+  {
+    dejson_fail(state, DEJSON_UNTERMINATED_ARRAY);
+    return 1;
+  }
+
+  state->json++;
+  return 1;
+}
+
+/* Follows the keys in path, separated by dots, down to the arrays to walk */
+static int dejson_walk_path(dejson_state_t* state, dejson_walk_t* walk, const char* path)
+{
+  if (*state->json == 'n')
+  {
+    dejson_skip_null(state);
+    return 1;
+  }
+  else if (*path == 0)
+  {
+    return dejson_walk_array(state, walk);
+  }
+
+  const char* dot = strchr(path, '.');
+  size_t length = dot != NULL ? (size_t)(dot - path) : strlen(path);
+
+  /* A record with a single field lets dejson_parse_key match the key */
+  dejson_record_field_meta_t key;
+  dejson_record_meta_t meta;
+
+  memset((void*)&key, 0, sizeof(key));
+  memset((void*)&meta, 0, sizeof(meta));
+  key.name_hash = dejson_hash((const uint8_t*)path, length);
+  meta.fields = &key;
+  meta.num_fields = 1;
+
+  if (*state->json != '{')
+  {
+    dejson_fail(state, DEJSON_INVALID_VALUE);
+    return 1;
+  }
 
-    if (i != meta->num_fields)
+  state->json++;
+  dejson_skip_spaces(state);
+
+  while (*state->json != '}')
+  {
+    if (dejson_parse_key(state, &meta) != NULL)
     {
-      dejson_parse_value(state, (void*)((uint8_t*)record + field->offset), field);
+      if (!dejson_walk_path(state, walk, path + length + (dot != NULL)))
+      {
+        return 0;
+      }
     }
     else
     {
@@ -784,55 +3312,124 @@ static void dejson_parse_object(dejson_state_t* state, void* record, const dejso
 
   if (*state->json != '}')
   {
-    longjmp(state->rollback, DEJSON_UNTERMINATED_OBJECT);
+    dejson_fail(state, DEJSON_UNTERMINATED_OBJECT);
+    return 1;
   }
 
   state->json++;
+  return 1;
 }
 
-static int dejson_execute(void* buffer, uint32_t hash, const uint8_t* json, int counting)
+int dejson_foreach(void* scratch, size_t size, uint32_t hash, const uint8_t* json, const char* path, dejson_element_t callback, void* userdata)
 {
-  const dejson_record_meta_t* meta = dejson_resolve_record(hash);
-  
-  if (!meta)
+  return dejson_foreach_feed(scratch, size, hash, json, path, callback, userdata, NULL);
+}
+
+int dejson_foreach_feed(void* scratch, size_t size, uint32_t hash, const uint8_t* json, const char* path, dejson_element_t callback, void* userdata, dejson_feed_t* feed)
+{
+  dejson_walk_t walk;
+  walk.meta = dejson_resolve_record(hash);
+
+  if (!walk.meta)
   {
     return DEJSON_UNKOWN_RECORD;
   }
 
+  walk.scratch = scratch;
+  walk.size = size;
+  walk.callback = callback;
+  walk.userdata = userdata;
+  walk.index = 0;
+
   dejson_state_t state;
-  int res;
-  
-  if ((res = setjmp(state.rollback)) != 0)
-  {
-    return res;
-  }
 
   state.json = json;
-  state.buffer = counting ? 0 : (uintptr_t)buffer;
-  state.counting = counting;
+  state.feed = feed;
+  state.counting = DEJSON_VALIDATING;
+  state.error = DEJSON_OK;
+  state.depth = 0;
 
-  void* record = dejson_alloc(&state, meta->size, meta->alignment);
-  
   dejson_skip_spaces(&state);
-  dejson_parse_object(&state, record, meta);
+
+  if (!dejson_walk_path(&state, &walk, path != NULL ? path : ""))
+  {
+    return DEJSON_OK;
+  }
+
   dejson_skip_spaces(&state);
 
-  if (counting)
+  if (state.error != DEJSON_OK)
   {
-    *(size_t*)buffer = state.buffer;
+    return state.error;
   }
 
   return *state.json == 0 ? DEJSON_OK : DEJSON_EOF_EXPECTED;
 }
 
-int dejson_deserialize(void* buffer, uint32_t hash, const uint8_t* json)
+static int dejson_is_boundary(uint8_t c)
 {
-  return dejson_execute(buffer, hash, json, 0);
+  return DEJSON_IS_SPACE(c) || c == '{' || c == '}' || c == '[' || c == ']' || c == ',' || c == ':';
 }
 
-int dejson_get_size(size_t* size, uint32_t hash, const uint8_t* json)
+size_t dejson_feed_cut(const uint8_t* json, size_t begin, size_t end, size_t cut, int* in_string)
+{
+  while (begin < end)
+  {
+    const uint8_t* quote = (const uint8_t*)memchr((const void*)(json + begin), '"', end - begin);
+    size_t next = quote != NULL ? (size_t)(quote - json) : end;
+
+    if (*in_string)
+    {
+      if (quote == NULL)
+      {
+        break;
+      }
+
+      /* The quote is escaped if preceded by an odd number of backslashes */
+      size_t slashes = 0;
+
+      while (json[next - slashes - 1] == '\\')
+      {
+        slashes++;
+      }
+
+      if ((slashes & 1) == 0)
+      {
+        *in_string = 0;
+        cut = next + 1;
+      }
+    }
+    else
+    {
+      size_t last = next;
+
+      while (last > begin && !dejson_is_boundary(json[last - 1]))
+      {
+        last--;
+      }
+
+      if (last > begin)
+      {
+        cut = last;
+      }
+
+      *in_string = quote != NULL;
+    }
+
+    begin = next + 1;
+  }
+
+  return cut;
+}
+
+int dejson_apply_patch(void* root, void* overflow, size_t size, uint32_t hash, const uint8_t* patch)
+{
+  return dejson_execute_patch(root, overflow, size, hash, patch, 0);
+}
+
+int dejson_get_patch_size(size_t* size, const void* root, uint32_t hash, const uint8_t* patch)
 {
-  return dejson_execute((void*)size, hash, json, 1);
+  return dejson_execute_patch((void*)root, (void*)size, 0, hash, patch, 1);
 }
 
 uint32_t dejson_hash(const uint8_t* str, size_t length)
@@ -850,3 +3447,44 @@ uint32_t dejson_hash(const uint8_t* str, size_t length)
 
   return hash;
 }
+
+void* dejson_map_find(const dejson_map_t* map, const char* key, size_t length)
+{
+  if (map->capacity == 0)
+  {
+    return NULL;
+  }
+
+  uint32_t hash = dejson_hash((const uint8_t*)key, length);
+  uint32_t* slot = dejson_map_slot(map, key, length, hash);
+
+  if (*slot == 0)
+  {
+    return NULL;
+  }
+
+  return DEJSON_GET_VALUE(*map, (*slot - 1));
+}
+
+void* dejson_index_find(const dejson_indexed_array_t* array, const void* key)
+{
+  if (array->capacity == 0 || (array->key_type == DEJSON_TYPE_STRING && *(const char* const*)key == NULL))
+  {
+    return NULL;
+  }
+
+  uint32_t* slot = dejson_index_slot(array, key, dejson_index_hash(key, array->key_type));
+
+  if (*slot == 0)
+  {
+    return NULL;
+  }
+
+  return DEJSON_GET_ELEMENT(*array, (*slot - 1));
+}
+
+const char* dejson_enum_name(const dejson_enum_meta_t* meta, uint32_t value)
+{
+  /* Zero wraps around and is rejected along with values past the last one */
+  return value - 1 < meta->count ? meta->names[value - 1] : NULL;
+}
@@ -0,0 +1,327 @@
+#define _POSIX_C_SOURCE 200112L
+
+#include <dejson_cache.h>
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct dejson_entry_t dejson_entry_t;
+
+/* The root starts at the first 16-byte boundary after the header, followed by the copy of the input */
+struct dejson_entry_t
+{
+  dejson_entry_t* next;
+  dejson_entry_t* newer;
+  dejson_entry_t* older;
+  uint64_t        key;
+  size_t          size;
+  size_t          length;
+  size_t          bytes;
+  uint32_t        hash;
+  unsigned        refs;
+  int             cached;
+};
+
+#define DEJSON_ENTRY_OFFSET ((sizeof(dejson_entry_t) + 15) & ~(size_t)15)
+#define DEJSON_ENTRY_ROOT(entry) ((uint8_t*)(entry) + DEJSON_ENTRY_OFFSET)
+
+struct dejson_cache_t
+{
+  pthread_mutex_t      mutex;
+  dejson_entry_t**     buckets;
+  size_t               mask;
+  size_t               budget;
+
+  /* Least recently used order, oldest entries are evicted first */
+  dejson_entry_t*      newest;
+  dejson_entry_t*      oldest;
+
+  dejson_cache_stats_t stats;
+};
+
+#define DEJSON_ROTL(x, r) ((x) << (r) | (x) >> (64 - (r)))
+
+/* Hashes eight bytes at a time, every lookup hashes the whole input so this must be fast */
+static uint64_t dejson_hash_input(const uint8_t* json, size_t length, uint32_t seed)
+{
+  const uint64_t c1 = 0x87c37b91114253d5ULL, c2 = 0x4cf5ad432745937fULL;
+  uint64_t h = seed ^ (length * 0x9e3779b97f4a7c15ULL);
+  uint64_t k;
+
+  for (; length >= 8; json += 8, length -= 8)
+  {
+    memcpy((void*)&k, (const void*)json, 8);
+    k *= c1;
+    k = DEJSON_ROTL(k, 31) * c2;
+    h ^= k;
+    h = DEJSON_ROTL(h, 27) * 5 + 0x52dce729;
+  }
+
+  k = 0;
+  memcpy((void*)&k, (const void*)json, length);
+  k *= c1;
+  h ^= DEJSON_ROTL(k, 31) * c2;
+
+  /* MurmurHash3's finalizer */
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53ULL;
+  h ^= h >> 33;
+  return h;
+}
+
+int dejson_cache_create(dejson_cache_t** cache, size_t budget)
+{
+  dejson_cache_t* self = (dejson_cache_t*)malloc(sizeof(*self));
+
+  if (self == NULL)
+  {
+    return DEJSON_OUT_OF_MEMORY;
+  }
+
+  self->mask = 63;
+  self->buckets = (dejson_entry_t**)calloc(self->mask + 1, sizeof(dejson_entry_t*));
+
+  if (self->buckets == NULL)
+  {
+    free((void*)self);
+    return DEJSON_OUT_OF_MEMORY;
+  }
+
+  self->budget = budget;
+  self->newest = self->oldest = NULL;
+  memset((void*)&self->stats, 0, sizeof(self->stats));
+  pthread_mutex_init(&self->mutex, NULL);
+
+  *cache = self;
+  return DEJSON_OK;
+}
+
+void dejson_cache_destroy(dejson_cache_t* cache)
+{
+  dejson_entry_t* entry = cache->newest;
+
+  while (entry != NULL)
+  {
+    dejson_entry_t* older = entry->older;
+    free((void*)entry);
+    entry = older;
+  }
+
+  pthread_mutex_destroy(&cache->mutex);
+  free((void*)cache->buckets);
+  free((void*)cache);
+}
+
+/* The functions below must be called with the mutex held */
+
+static dejson_entry_t* dejson_cache_find(dejson_cache_t* cache, uint64_t key, uint32_t hash, const uint8_t* json, size_t length)
+{
+  dejson_entry_t* entry = cache->buckets[key & cache->mask];
+
+  for (; entry != NULL; entry = entry->next)
+  {
+    /* A different input with the same key is a miss, the cache never returns the wrong document */
+    if (entry->key == key && entry->hash == hash && entry->length == length &&
+        memcmp((const void*)(DEJSON_ENTRY_ROOT(entry) + entry->size), (const void*)json, length) == 0)
+    {
+      return entry;
+    }
+  }
+
+  return NULL;
+}
+
+static void dejson_cache_unlink(dejson_cache_t* cache, dejson_entry_t* entry)
+{
+  *(entry->newer != NULL ? &entry->newer->older : &cache->newest) = entry->older;
+  *(entry->older != NULL ? &entry->older->newer : &cache->oldest) = entry->newer;
+}
+
+static void dejson_cache_push(dejson_cache_t* cache, dejson_entry_t* entry)
+{
+  entry->newer = NULL;
+  entry->older = cache->newest;
+  *(cache->newest != NULL ? &cache->newest->newer : &cache->oldest) = entry;
+  cache->newest = entry;
+}
+
+static void dejson_cache_grow(dejson_cache_t* cache)
+{
+  size_t mask = cache->mask * 2 + 1;
+  dejson_entry_t* entry;
+  dejson_entry_t** buckets = (dejson_entry_t**)calloc(mask + 1, sizeof(dejson_entry_t*));
+
+  /* The table just stays more loaded if it can't grow */
+  if (buckets == NULL)
+  {
+    return;
+  }
+
+  for (entry = cache->newest; entry != NULL; entry = entry->older)
+  {
+    entry->next = buckets[entry->key & mask];
+    buckets[entry->key & mask] = entry;
+  }
+
+  free((void*)cache->buckets);
+  cache->buckets = buckets;
+  cache->mask = mask;
+}
+
+static void dejson_cache_insert(dejson_cache_t* cache, dejson_entry_t* entry)
+{
+  if (cache->stats.entries > cache->mask)
+  {
+    dejson_cache_grow(cache);
+  }
+
+  dejson_entry_t** bucket = cache->buckets + (entry->key & cache->mask);
+  entry->next = *bucket;
+  *bucket = entry;
+  entry->cached = 1;
+
+  dejson_cache_push(cache, entry);
+  cache->stats.entries++;
+  cache->stats.bytes += entry->bytes;
+}
+
+/* Entries still in use leave the cache now and are freed on their last release */
+static void dejson_cache_evict(dejson_cache_t* cache)
+{
+  while (cache->stats.bytes > cache->budget)
+  {
+    dejson_entry_t* entry = cache->oldest;
+    dejson_entry_t** bucket = cache->buckets + (entry->key & cache->mask);
+
+    while (*bucket != entry)
+    {
+      bucket = &(*bucket)->next;
+    }
+
+    *bucket = entry->next;
+    dejson_cache_unlink(cache, entry);
+    entry->cached = 0;
+
+    cache->stats.entries--;
+    cache->stats.bytes -= entry->bytes;
+    cache->stats.evictions++;
+
+    if (entry->refs == 0)
+    {
+      free((void*)entry);
+    }
+  }
+}
+
+static const void* dejson_cache_acquire(dejson_cache_t* cache, dejson_entry_t* entry)
+{
+  entry->refs++;
+
+  if (entry->cached && cache->newest != entry)
+  {
+    dejson_cache_unlink(cache, entry);
+    dejson_cache_push(cache, entry);
+  }
+
+  return (const void*)DEJSON_ENTRY_ROOT(entry);
+}
+
+int dejson_cache_deserialize(dejson_cache_t* cache, const void** root, uint32_t hash, const uint8_t* json)
+{
+  size_t length = strlen((const char*)json);
+  uint64_t key = dejson_hash_input(json, length, hash);
+
+  pthread_mutex_lock(&cache->mutex);
+  dejson_entry_t* entry = dejson_cache_find(cache, key, hash, json, length);
+
+  if (entry != NULL)
+  {
+    cache->stats.hits++;
+    *root = dejson_cache_acquire(cache, entry);
+    pthread_mutex_unlock(&cache->mutex);
+    return DEJSON_OK;
+  }
+
+  cache->stats.misses++;
+  pthread_mutex_unlock(&cache->mutex);
+
+  size_t size;
+  int res = dejson_get_size(&size, hash, json);
+
+  if (res != DEJSON_OK)
+  {
+    return res;
+  }
+
+  size_t bytes = DEJSON_ENTRY_OFFSET + size + length + 1;
+  entry = (dejson_entry_t*)malloc(bytes);
+
+  if (entry == NULL)
+  {
+    return DEJSON_OUT_OF_MEMORY;
+  }
+
+  /* The input is copied after the data so that json fields point into the entry */
+  uint8_t* copy = DEJSON_ENTRY_ROOT(entry) + size;
+  memcpy((void*)copy, (const void*)json, length + 1);
+
+  res = dejson_deserialize((void*)DEJSON_ENTRY_ROOT(entry), hash, copy);
+
+  if (res != DEJSON_OK)
+  {
+    free((void*)entry);
+    return res;
+  }
+
+  entry->key = key;
+  entry->size = size;
+  entry->length = length;
+  entry->bytes = bytes;
+  entry->hash = hash;
+  entry->refs = 0;
+  entry->cached = 0;
+
+  pthread_mutex_lock(&cache->mutex);
+
+  /* Another thread may have deserialized the same input in the meantime */
+  dejson_entry_t* other = dejson_cache_find(cache, key, hash, json, length);
+
+  if (other != NULL)
+  {
+    free((void*)entry);
+    entry = other;
+  }
+  else if (bytes <= cache->budget)
+  {
+    dejson_cache_insert(cache, entry);
+    dejson_cache_evict(cache);
+  }
+
+  *root = dejson_cache_acquire(cache, entry);
+  pthread_mutex_unlock(&cache->mutex);
+  return DEJSON_OK;
+}
+
+void dejson_cache_release(dejson_cache_t* cache, const void* root)
+{
+  dejson_entry_t* entry = (dejson_entry_t*)((uint8_t*)root - DEJSON_ENTRY_OFFSET);
+
+  pthread_mutex_lock(&cache->mutex);
+
+  if (--entry->refs == 0 && !entry->cached)
+  {
+    free((void*)entry);
+  }
+
+  pthread_mutex_unlock(&cache->mutex);
+}
+
+void dejson_cache_stats(dejson_cache_t* cache, dejson_cache_stats_t* stats)
+{
+  pthread_mutex_lock(&cache->mutex);
+  *stats = cache->stats;
+  pthread_mutex_unlock(&cache->mutex);
+}
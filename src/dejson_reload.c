@@ -0,0 +1,230 @@
+#define _POSIX_C_SOURCE 200112L
+
+#include <dejson_reload.h>
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define DEJSON_CACHE_LINE 64
+
+typedef struct dejson_arena_t dejson_arena_t;
+
+/* The root starts at the first 16-byte boundary after the header, just like a malloc'd buffer */
+struct dejson_arena_t
+{
+  dejson_arena_t* next;
+  uint64_t        epoch;
+};
+
+#define DEJSON_ARENA_OFFSET ((sizeof(dejson_arena_t) + 15) & ~(size_t)15)
+
+/* epoch is zero while the reader is outside, each one has its own cache line */
+struct dejson_reader_t
+{
+  dejson_reload_t* reload;
+  uint64_t         epoch;
+  int              joined;
+}
+__attribute__((aligned(DEJSON_CACHE_LINE)));
+
+struct dejson_reload_t
+{
+  /* Read by the readers */
+  dejson_arena_t*  current;
+  uint64_t         epoch;
+  dejson_reader_t* readers;
+  unsigned         max_readers;
+  uint32_t         hash;
+
+  /* Arenas waiting for the readers to move on, only touched with the mutex held */
+  pthread_mutex_t  mutex;
+  dejson_arena_t*  retired;
+};
+
+int dejson_reload_create(dejson_reload_t** reload, uint32_t hash, unsigned max_readers)
+{
+  dejson_reload_t* self = (dejson_reload_t*)malloc(sizeof(*self));
+  void* readers;
+
+  if (self == NULL)
+  {
+    return DEJSON_OUT_OF_MEMORY;
+  }
+
+  if (posix_memalign(&readers, DEJSON_CACHE_LINE, sizeof(dejson_reader_t) * (max_readers != 0 ? max_readers : 1)) != 0)
+  {
+    free((void*)self);
+    return DEJSON_OUT_OF_MEMORY;
+  }
+
+  self->current = NULL;
+  self->epoch = 1;
+  self->readers = (dejson_reader_t*)readers;
+  self->max_readers = max_readers;
+  self->hash = hash;
+  self->retired = NULL;
+  pthread_mutex_init(&self->mutex, NULL);
+
+  for (unsigned i = 0; i < max_readers; i++)
+  {
+    self->readers[i].reload = self;
+    self->readers[i].epoch = 0;
+    self->readers[i].joined = 0;
+  }
+
+  *reload = self;
+  return DEJSON_OK;
+}
+
+void dejson_reload_destroy(dejson_reload_t* reload)
+{
+  dejson_arena_t* arena = reload->retired;
+
+  while (arena != NULL)
+  {
+    dejson_arena_t* next = arena->next;
+    free((void*)arena);
+    arena = next;
+  }
+
+  free((void*)reload->current);
+  pthread_mutex_destroy(&reload->mutex);
+  free((void*)reload->readers);
+  free((void*)reload);
+}
+
+/*
+A reader that entered at an epoch before the one an arena was retired at may
+still be using it. Readers at that epoch or later loaded the current pointer
+after the swap, since the swap comes before the epoch is bumped.
+*/
+static size_t dejson_reclaim(dejson_reload_t* reload)
+{
+  uint64_t oldest = UINT64_MAX;
+  size_t count = 0;
+
+  for (unsigned i = 0; i < reload->max_readers; i++)
+  {
+    uint64_t epoch = __atomic_load_n(&reload->readers[i].epoch, __ATOMIC_SEQ_CST);
+
+    if (epoch != 0 && epoch < oldest)
+    {
+      oldest = epoch;
+    }
+  }
+
+  dejson_arena_t** arena = &reload->retired;
+
+  while (*arena != NULL)
+  {
+    if ((*arena)->epoch <= oldest)
+    {
+      dejson_arena_t* next = (*arena)->next;
+      free((void*)*arena);
+      *arena = next;
+      count++;
+    }
+    else
+    {
+      arena = &(*arena)->next;
+    }
+  }
+
+  return count;
+}
+
+int dejson_reload_update(dejson_reload_t* reload, const uint8_t* json)
+{
+  size_t size;
+  int res = dejson_get_size(&size, reload->hash, json);
+
+  if (res != DEJSON_OK)
+  {
+    return res;
+  }
+
+  /* The input is copied after the data so that json fields point into the arena */
+  size_t length = strlen((const char*)json);
+  dejson_arena_t* arena = (dejson_arena_t*)malloc(DEJSON_ARENA_OFFSET + size + length + 1);
+
+  if (arena == NULL)
+  {
+    return DEJSON_OUT_OF_MEMORY;
+  }
+
+  uint8_t* root = (uint8_t*)arena + DEJSON_ARENA_OFFSET;
+  uint8_t* copy = root + size;
+  memcpy((void*)copy, (const void*)json, length + 1);
+
+  res = dejson_deserialize((void*)root, reload->hash, copy);
+
+  if (res != DEJSON_OK)
+  {
+    free((void*)arena);
+    return res;
+  }
+
+  arena->next = NULL;
+  arena->epoch = 0;
+
+  pthread_mutex_lock(&reload->mutex);
+
+  dejson_arena_t* old = __atomic_exchange_n(&reload->current, arena, __ATOMIC_SEQ_CST);
+
+  if (old != NULL)
+  {
+    old->epoch = __atomic_add_fetch(&reload->epoch, 1, __ATOMIC_SEQ_CST);
+    old->next = reload->retired;
+    reload->retired = old;
+  }
+
+  dejson_reclaim(reload);
+  pthread_mutex_unlock(&reload->mutex);
+  return DEJSON_OK;
+}
+
+size_t dejson_reload_collect(dejson_reload_t* reload)
+{
+  pthread_mutex_lock(&reload->mutex);
+  size_t count = dejson_reclaim(reload);
+  pthread_mutex_unlock(&reload->mutex);
+  return count;
+}
+
+dejson_reader_t* dejson_reload_join(dejson_reload_t* reload)
+{
+  for (unsigned i = 0; i < reload->max_readers; i++)
+  {
+    int expected = 0;
+
+    if (__atomic_compare_exchange_n(&reload->readers[i].joined, &expected, 1, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+    {
+      return reload->readers + i;
+    }
+  }
+
+  return NULL;
+}
+
+void dejson_reload_quit(dejson_reader_t* reader)
+{
+  __atomic_store_n(&reader->epoch, 0, __ATOMIC_RELEASE);
+  __atomic_store_n(&reader->joined, 0, __ATOMIC_RELEASE);
+}
+
+const void* dejson_reload_enter(dejson_reader_t* reader)
+{
+  dejson_reload_t* reload = reader->reload;
+
+  /* The epoch must be visible to dejson_reclaim before the pointer is loaded */
+  __atomic_store_n(&reader->epoch, __atomic_load_n(&reload->epoch, __ATOMIC_SEQ_CST), __ATOMIC_SEQ_CST);
+  dejson_arena_t* arena = __atomic_load_n(&reload->current, __ATOMIC_SEQ_CST);
+
+  return arena != NULL ? (const void*)((const uint8_t*)arena + DEJSON_ARENA_OFFSET) : NULL;
+}
+
+void dejson_reload_leave(dejson_reader_t* reader)
+{
+  __atomic_store_n(&reader->epoch, 0, __ATOMIC_RELEASE);
+}
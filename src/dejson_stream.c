@@ -0,0 +1,372 @@
+#include <dejson_stream.h>
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef DEJSON_HAS_ZLIB
+#include <zlib.h>
+#endif
+
+#ifdef DEJSON_HAS_ZSTD
+#include <zstd.h>
+#endif
+
+#define DEJSON_CHUNK_SIZE  65536
+#define DEJSON_CHUNK_COUNT 4
+
+typedef struct
+{
+  dejson_feed_t          feed;
+  const dejson_stream_t* stream;
+
+  /* Ring of decompressed chunks handed from the decoder thread to the parser */
+  pthread_mutex_t mutex;
+  pthread_cond_t  filled;
+  pthread_cond_t  emptied;
+  uint8_t         chunks[DEJSON_CHUNK_COUNT][DEJSON_CHUNK_SIZE];
+  size_t          lengths[DEJSON_CHUNK_COUNT];
+  unsigned        head;
+  unsigned        tail;
+  int             done;
+  int             cancelled;
+  int             error;
+
+  /* The decompressed document, only touched by the parser thread */
+  uint8_t* json;
+  size_t   length;
+  size_t   cut;
+  uint8_t  held;
+  int      in_string;
+  int      overflow;
+}
+dejson_pipe_t;
+
+static uint8_t* dejson_acquire(dejson_pipe_t* pipe)
+{
+  uint8_t* chunk = NULL;
+
+  pthread_mutex_lock(&pipe->mutex);
+
+  while (pipe->tail - pipe->head == DEJSON_CHUNK_COUNT && !pipe->cancelled)
+  {
+    pthread_cond_wait(&pipe->emptied, &pipe->mutex);
+  }
+
+  if (!pipe->cancelled)
+  {
+    chunk = pipe->chunks[pipe->tail % DEJSON_CHUNK_COUNT];
+  }
+
+  pthread_mutex_unlock(&pipe->mutex);
+  return chunk;
+}
+
+static void dejson_release(dejson_pipe_t* pipe, size_t length)
+{
+  if (length != 0)
+  {
+    pthread_mutex_lock(&pipe->mutex);
+    pipe->lengths[pipe->tail % DEJSON_CHUNK_COUNT] = length;
+    pipe->tail++;
+    pthread_cond_signal(&pipe->filled);
+    pthread_mutex_unlock(&pipe->mutex);
+  }
+}
+
+static int dejson_decode_plain(dejson_pipe_t* pipe)
+{
+  const dejson_stream_t* stream = pipe->stream;
+
+  for (;;)
+  {
+    uint8_t* chunk = dejson_acquire(pipe);
+
+    if (chunk == NULL)
+    {
+      return 0;
+    }
+
+    size_t length = stream->read(stream->userdata, (void*)chunk, DEJSON_CHUNK_SIZE);
+
+    if (length == 0)
+    {
+      return 0;
+    }
+
+    dejson_release(pipe, length);
+  }
+}
+
+#ifdef DEJSON_HAS_ZLIB
+static int dejson_decode_gzip(dejson_pipe_t* pipe)
+{
+  const dejson_stream_t* stream = pipe->stream;
+  uint8_t input[DEJSON_CHUNK_SIZE];
+  z_stream z;
+
+  memset((void*)&z, 0, sizeof(z));
+
+  /* 15 + 32 accepts both gzip and zlib headers with the maximum window size */
+  if (inflateInit2(&z, 15 + 32) != Z_OK)
+  {
+    return -1;
+  }
+
+  int res = Z_OK;
+  int pending = 0;
+
+  for (;;)
+  {
+    /* Output might still be pending if the last chunk was filled */
+    if (z.avail_in == 0 && !pending)
+    {
+      z.next_in = input;
+      z.avail_in = stream->read(stream->userdata, (void*)input, sizeof(input));
+
+      if (z.avail_in == 0)
+      {
+        break;
+      }
+    }
+
+    if (res == Z_STREAM_END)
+    {
+      /* Concatenated gzip members */
+      inflateReset(&z);
+    }
+
+    uint8_t* chunk = dejson_acquire(pipe);
+
+    if (chunk == NULL)
+    {
+      break;
+    }
+
+    z.next_out = chunk;
+    z.avail_out = DEJSON_CHUNK_SIZE;
+    res = inflate(&z, Z_NO_FLUSH);
+    pending = res == Z_OK && z.avail_out == 0;
+    dejson_release(pipe, DEJSON_CHUNK_SIZE - z.avail_out);
+
+    if (res != Z_OK && res != Z_STREAM_END && res != Z_BUF_ERROR)
+    {
+      break;
+    }
+  }
+
+  inflateEnd(&z);
+  return res == Z_STREAM_END || pipe->cancelled ? 0 : -1;
+}
+#endif
+
+#ifdef DEJSON_HAS_ZSTD
+static int dejson_decode_zstd(dejson_pipe_t* pipe)
+{
+  const dejson_stream_t* stream = pipe->stream;
+  uint8_t input[DEJSON_CHUNK_SIZE];
+  ZSTD_DStream* zds = ZSTD_createDStream();
+
+  if (zds == NULL)
+  {
+    return -1;
+  }
+
+  ZSTD_inBuffer in = {input, 0, 0};
+  size_t res = ZSTD_initDStream(zds);
+  int pending = 0;
+
+  while (!ZSTD_isError(res))
+  {
+    /* Output might still be pending if the last chunk was filled */
+    if (in.pos == in.size && !pending)
+    {
+      in.size = stream->read(stream->userdata, (void*)input, sizeof(input));
+      in.pos = 0;
+
+      if (in.size == 0)
+      {
+        break;
+      }
+    }
+
+    uint8_t* chunk = dejson_acquire(pipe);
+
+    if (chunk == NULL)
+    {
+      break;
+    }
+
+    ZSTD_outBuffer out = {(void*)chunk, DEJSON_CHUNK_SIZE, 0};
+    res = ZSTD_decompressStream(zds, &out, &in);
+    pending = out.pos == out.size;
+    dejson_release(pipe, out.pos);
+  }
+
+  ZSTD_freeDStream(zds);
+
+  /* A zero return means the last frame was completely decoded and flushed */
+  return res == 0 || pipe->cancelled ? 0 : -1;
+}
+#endif
+
+static void* dejson_decode(void* userdata)
+{
+  dejson_pipe_t* pipe = (dejson_pipe_t*)userdata;
+  int res = -1;
+
+  switch (pipe->stream->format)
+  {
+  case DEJSON_STREAM_PLAIN:
+    res = dejson_decode_plain(pipe);
+    break;
+
+#ifdef DEJSON_HAS_ZLIB
+  case DEJSON_STREAM_GZIP:
+    res = dejson_decode_gzip(pipe);
+    break;
+#endif
+
+#ifdef DEJSON_HAS_ZSTD
+  case DEJSON_STREAM_ZSTD:
+    res = dejson_decode_zstd(pipe);
+    break;
+#endif
+  }
+
+  pthread_mutex_lock(&pipe->mutex);
+  pipe->done = 1;
+  pipe->error = res != 0;
+  pthread_cond_signal(&pipe->filled);
+  pthread_mutex_unlock(&pipe->mutex);
+  return NULL;
+}
+
+static int dejson_more(dejson_feed_t* feed, const uint8_t* json)
+{
+  dejson_pipe_t* pipe = (dejson_pipe_t*)feed;
+  size_t pos = json - pipe->json;
+
+  if (pos < pipe->cut)
+  {
+    /* A NUL in the document itself */
+    return 0;
+  }
+
+  pipe->json[pipe->cut] = pipe->held;
+
+  while (pipe->cut <= pos)
+  {
+    pthread_mutex_lock(&pipe->mutex);
+
+    while (pipe->head == pipe->tail && !pipe->done)
+    {
+      pthread_cond_wait(&pipe->filled, &pipe->mutex);
+    }
+
+    if (pipe->head == pipe->tail)
+    {
+      pthread_mutex_unlock(&pipe->mutex);
+
+      /* End of the input, whatever is left goes to the parser */
+      pipe->cut = pipe->length;
+      break;
+    }
+
+    const uint8_t* chunk = pipe->chunks[pipe->head % DEJSON_CHUNK_COUNT];
+    size_t length = pipe->lengths[pipe->head % DEJSON_CHUNK_COUNT];
+    pthread_mutex_unlock(&pipe->mutex);
+
+    if (length > pipe->stream->capacity - pipe->length)
+    {
+      pipe->overflow = 1;
+      pipe->cut = pipe->length;
+      break;
+    }
+
+    memcpy((void*)(pipe->json + pipe->length), (const void*)chunk, length);
+    pipe->cut = dejson_feed_cut(pipe->json, pipe->length, pipe->length + length, pipe->cut, &pipe->in_string);
+    pipe->length += length;
+    pipe->json[pipe->length] = 0;
+
+    pthread_mutex_lock(&pipe->mutex);
+    pipe->head++;
+    pthread_cond_signal(&pipe->emptied);
+    pthread_mutex_unlock(&pipe->mutex);
+  }
+
+  pipe->held = pipe->json[pipe->cut];
+  pipe->json[pipe->cut] = 0;
+  return pipe->cut > pos;
+}
+
+int dejson_stream_get_size(size_t* size, uint8_t** json, uint32_t hash, const dejson_stream_t* stream)
+{
+  dejson_pipe_t* pipe = (dejson_pipe_t*)calloc(1, sizeof(dejson_pipe_t));
+
+  if (pipe == NULL)
+  {
+    return DEJSON_OUT_OF_MEMORY;
+  }
+
+  pipe->json = (uint8_t*)malloc(stream->capacity + 1);
+
+  if (pipe->json == NULL)
+  {
+    free((void*)pipe);
+    return DEJSON_OUT_OF_MEMORY;
+  }
+
+  pipe->feed.more = dejson_more;
+  pipe->stream = stream;
+  pipe->json[0] = 0;
+
+  pthread_mutex_init(&pipe->mutex, NULL);
+  pthread_cond_init(&pipe->filled, NULL);
+  pthread_cond_init(&pipe->emptied, NULL);
+
+  pthread_t thread;
+  int res;
+
+  if (pthread_create(&thread, NULL, dejson_decode, (void*)pipe) != 0)
+  {
+    res = DEJSON_STREAM_ERROR;
+  }
+  else
+  {
+    res = dejson_get_size_feed(size, hash, pipe->json, &pipe->feed);
+
+    /* Unblock the decoder if the parser stopped early */
+    pthread_mutex_lock(&pipe->mutex);
+    pipe->cancelled = 1;
+    pthread_cond_signal(&pipe->emptied);
+    pthread_mutex_unlock(&pipe->mutex);
+
+    pthread_join(thread, NULL);
+
+    if (pipe->overflow)
+    {
+      res = DEJSON_OUT_OF_MEMORY;
+    }
+    else if (pipe->error)
+    {
+      res = DEJSON_STREAM_ERROR;
+    }
+  }
+
+  pthread_cond_destroy(&pipe->emptied);
+  pthread_cond_destroy(&pipe->filled);
+  pthread_mutex_destroy(&pipe->mutex);
+
+  if (res == DEJSON_OK)
+  {
+    *json = pipe->json;
+  }
+  else
+  {
+    free((void*)pipe->json);
+  }
+
+  free((void*)pipe);
+  return res;
+}
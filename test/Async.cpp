@@ -0,0 +1,343 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include <coroutine>
+#include <deque>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "RetroAchievements.hpp"
+
+/* A minimal single-threaded reactor */
+class reactor
+{
+public:
+  void schedule(std::coroutine_handle<> handle)
+  {
+    ready_.push_back(handle);
+  }
+
+  void wait(int fd, short events, std::coroutine_handle<> handle)
+  {
+    waiting_.push_back(waiting{fd, events, handle});
+  }
+
+  void run()
+  {
+    while (!ready_.empty() || !waiting_.empty())
+    {
+      if (!waiting_.empty())
+      {
+        std::vector<pollfd> fds;
+
+        for (const waiting& w : waiting_)
+        {
+          fds.push_back(pollfd{w.fd, w.events, 0});
+        }
+
+        poll(fds.data(), fds.size(), ready_.empty() ? -1 : 0);
+
+        for (size_t i = fds.size(); i-- > 0;)
+        {
+          if (fds[i].revents != 0)
+          {
+            ready_.push_back(waiting_[i].handle);
+            waiting_.erase(waiting_.begin() + i);
+          }
+        }
+      }
+
+      std::deque<std::coroutine_handle<>> ready;
+      ready.swap(ready_);
+
+      for (std::coroutine_handle<> handle : ready)
+      {
+        handle.resume();
+      }
+    }
+  }
+
+private:
+  struct waiting
+  {
+    int fd;
+    short events;
+    std::coroutine_handle<> handle;
+  };
+
+  std::deque<std::coroutine_handle<>> ready_;
+  std::vector<waiting> waiting_;
+};
+
+struct spawn
+{
+  struct promise_type
+  {
+    spawn get_return_object() { return {}; }
+    std::suspend_never initial_suspend() const noexcept { return {}; }
+    std::suspend_never final_suspend() const noexcept { return {}; }
+    void return_void() {}
+    void unhandled_exception() { abort(); }
+  };
+};
+
+struct yield_awaiter
+{
+  reactor& loop;
+
+  bool await_ready() const { return false; }
+  void await_suspend(std::coroutine_handle<> handle) { loop.schedule(handle); }
+  void await_resume() const {}
+};
+
+struct io_awaiter
+{
+  reactor& loop;
+  int fd;
+  short events;
+
+  bool await_ready() const { return false; }
+  void await_suspend(std::coroutine_handle<> handle) { loop.wait(fd, events, handle); }
+  void await_resume() const {}
+};
+
+class socket_source
+{
+public:
+  socket_source(reactor& loop, int fd) : loop_(loop), fd_(fd), yields(0) {}
+
+  struct read_awaiter
+  {
+    socket_source& source;
+    void* data;
+    size_t size;
+    ssize_t length;
+
+    bool await_ready()
+    {
+      length = ::read(source.fd_, data, size);
+      return length >= 0 || errno != EAGAIN;
+    }
+
+    void await_suspend(std::coroutine_handle<> handle)
+    {
+      source.loop_.wait(source.fd_, POLLIN, handle);
+    }
+
+    size_t await_resume()
+    {
+      if (length < 0 && errno == EAGAIN)
+      {
+        length = ::read(source.fd_, data, size);
+      }
+
+      if (length < 0)
+      {
+        throw std::runtime_error(strerror(errno));
+      }
+
+      return length;
+    }
+  };
+
+  read_awaiter read(void* data, size_t size)
+  {
+    return read_awaiter{*this, data, size, 0};
+  }
+
+  yield_awaiter yield()
+  {
+    yields++;
+    return yield_awaiter{loop_};
+  }
+
+private:
+  reactor& loop_;
+  int fd_;
+
+public:
+  unsigned yields;
+};
+
+static spawn write_all(reactor& loop, int fd, const std::string& json, size_t truncate)
+{
+  size_t pos = 0;
+  unsigned seed = 1;
+
+  while (pos < json.size() - truncate)
+  {
+    seed = seed * 1103515245 + 12345;
+    size_t size = 1 + (seed >> 16) % 8192;
+    size = size < json.size() - truncate - pos ? size : json.size() - truncate - pos;
+
+    ssize_t written = send(fd, (const void*)(json.data() + pos), size, MSG_NOSIGNAL);
+
+    if (written < 0 && errno == EAGAIN)
+    {
+      co_await io_awaiter{loop, fd, POLLOUT};
+      continue;
+    }
+    else if (written < 0)
+    {
+      /* The parser gave up early */
+      break;
+    }
+
+    pos += written;
+    co_await yield_awaiter{loop};
+  }
+
+  close(fd);
+}
+
+static spawn tick(reactor& loop, const bool& done, unsigned& ticks)
+{
+  while (!done)
+  {
+    ticks++;
+    co_await yield_awaiter{loop};
+  }
+}
+
+static std::string summarize(const Patch* patch)
+{
+  std::string summary = patch->PatchData.Title.chars;
+  char buffer[64];
+
+  for (unsigned i = 0; i < patch->PatchData.Achievements.count; i++)
+  {
+    const Achievement* a = (const Achievement*)DEJSON_GET_ELEMENT(patch->PatchData.Achievements, i);
+    snprintf(buffer, sizeof(buffer), "|%u:%u:", a->ID, a->Points);
+    summary += buffer;
+    summary += a->Title.chars;
+    summary += a->Description.chars;
+  }
+
+  return summary;
+}
+
+static spawn parse(reactor& loop, int fd, size_t capacity, int& error, std::string& summary, unsigned& yields, bool& done)
+{
+  socket_source source(loop, fd);
+  dejson::document<Patch> patch = co_await dejson::parse<Patch>(source, capacity, 4096);
+
+  error = patch.error();
+
+  if (patch)
+  {
+    summary = summarize(patch.get());
+  }
+
+  yields = source.yields;
+  done = true;
+  close(fd);
+}
+
+static int run(const char* name, const std::string& json, size_t capacity, size_t truncate, int expected)
+{
+  int fds[2];
+  socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+  fcntl(fds[0], F_SETFL, O_NONBLOCK);
+  fcntl(fds[1], F_SETFL, O_NONBLOCK);
+
+  reactor loop;
+  int error = -1;
+  std::string summary;
+  unsigned yields = 0, ticks = 0;
+  bool done = false;
+
+  parse(loop, fds[0], capacity, error, summary, yields, done);
+  write_all(loop, fds[1], json, truncate);
+  tick(loop, done, ticks);
+  loop.run();
+
+  bool ok = error == expected;
+
+  if (ok && expected == DEJSON_OK)
+  {
+    /* Compare against the blocking C API */
+    std::string copy = json;
+    size_t size;
+    dejson_get_size(&size, g_MetaPatch.name_hash, (const uint8_t*)copy.c_str());
+    void* buffer = malloc(size);
+    dejson_deserialize(buffer, g_MetaPatch.name_hash, (const uint8_t*)copy.c_str());
+    ok = summary == summarize((const Patch*)buffer);
+    free(buffer);
+  }
+
+  printf("%s: %s (error %d, %u yields, %u ticks)\n", name, ok ? "ok" : "FAILED", error, yields, ticks);
+  return ok ? 0 : 1;
+}
+
+static std::string load(const char* path)
+{
+  std::string json;
+  FILE* file = fopen(path, "rb");
+
+  if (file != NULL)
+  {
+    char buffer[65536];
+    size_t length;
+
+    while ((length = fread((void*)buffer, 1, sizeof(buffer), file)) != 0)
+    {
+      json.append(buffer, length);
+    }
+
+    fclose(file);
+  }
+
+  return json;
+}
+
+static std::string synthesize_patch(unsigned count)
+{
+  std::string json = "{\"Success\":true,\"PatchData\":{\"ID\":228,\"Title\":\"Super Mario World\",\"Achievements\":[";
+  char buffer[256];
+
+  for (unsigned i = 0; i < count; i++)
+  {
+    snprintf(buffer, sizeof(buffer), "%s{\"ID\":%u,\"Title\":\"Achievement #%u\",\"Description\":\"Collect \\\"%u\\\" coins\",\"Points\":%u}",
+      i == 0 ? "" : ",", 1000 + i, i, i * 7, 5 + i % 20);
+
+    json += buffer;
+  }
+
+  json += "],\"Leaderboards\":[]}}";
+  return json;
+}
+
+int main(int argc, const char* argv[])
+{
+  int failed = 0;
+
+  for (int i = 1; i < argc; i++)
+  {
+    std::string json = load(argv[i]);
+    failed += run(argv[i], json, json.size(), 0, DEJSON_OK);
+  }
+
+  std::string json = synthesize_patch(20000);
+  failed += run("synthetic", json, json.size(), 0, DEJSON_OK);
+  failed += run("capacity", json, json.size() - 1, 0, DEJSON_OUT_OF_MEMORY);
+  failed += run("truncated", json, json.size(), 1, DEJSON_UNTERMINATED_OBJECT);
+
+  /* Deep nesting must fail cleanly rather than overflow the parser's stack */
+  std::string deep = std::string(200, '[') + std::string(200, ']');
+  json = "{\"Unknown\":" + deep + "," + synthesize_patch(10).substr(1);
+  failed += run("deep", json, json.size(), 0, DEJSON_OK);
+
+  deep = std::string(5000, '[') + std::string(5000, ']');
+  json = "{\"Unknown\":" + deep + "}";
+  failed += run("too deep", json, json.size(), 0, DEJSON_TOO_DEEP);
+
+  return failed != 0;
+}
@@ -0,0 +1,236 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include <zlib.h>
+
+#include "dejson.h"
+#include "dejson_stream.h"
+#include "RetroAchievements.h"
+
+typedef std::chrono::steady_clock Clock;
+
+struct Corpus
+{
+  std::string name;
+  std::string json;
+  uint32_t hash;
+};
+
+static std::string load(const char* path)
+{
+  std::string json;
+  FILE* file = fopen(path, "rb");
+
+  if (file != NULL)
+  {
+    char buffer[65536];
+    size_t length;
+
+    while ((length = fread((void*)buffer, 1, sizeof(buffer), file)) != 0)
+    {
+      json.append(buffer, length);
+    }
+
+    fclose(file);
+  }
+
+  return json;
+}
+
+static std::string synthesize_patch(unsigned count)
+{
+  std::string json = "{\"Success\":true,\"PatchData\":{\"ID\":228,\"Title\":\"Super Mario World\",\"ConsoleID\":3,"
+                     "\"RichPresencePatch\":null,\"Achievements\":[";
+  char buffer[512];
+
+  for (unsigned i = 0; i < count; i++)
+  {
+    snprintf(buffer, sizeof(buffer),
+      "%s{\"ID\":%u,\"MemAddr\":\"0xH0dbf=1_0xH%04x>=%u\",\"Title\":\"Achievement #%u\","
+      "\"Description\":\"Collect \\\"%u\\\" coins in World %u\",\"Points\":%u,\"Author\":\"author%u\","
+      "\"Modified\":%u,\"Created\":%u,\"BadgeName\":\"%05u\",\"Flags\":3}",
+      i == 0 ? "" : ",", 1000 + i, i & 0xffff, i % 100, i, i * 7, i % 9, 5 + i % 20, i % 50,
+      1500000000U + i, 1400000000U + i, i);
+
+    json += buffer;
+  }
+
+  json += "],\"Leaderboards\":[]}}";
+  return json;
+}
+
+static std::string synthesize_unlocks(unsigned count)
+{
+  std::string json = "{\"Success\":true,\"UserUnlocks\":[";
+  char buffer[32];
+
+  for (unsigned i = 0; i < count; i++)
+  {
+    snprintf(buffer, sizeof(buffer), "%s%u", i == 0 ? "" : ",", 10000 + i * 13);
+    json += buffer;
+  }
+
+  json += "],\"GameID\":228,\"HardcoreMode\":false}";
+  return json;
+}
+
+static std::vector<uint8_t> gzip(const std::string& json)
+{
+  z_stream z;
+  memset((void*)&z, 0, sizeof(z));
+  deflateInit2(&z, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY);
+
+  std::vector<uint8_t> gz(deflateBound(&z, json.size()));
+  z.next_in = (Bytef*)json.data();
+  z.avail_in = json.size();
+  z.next_out = gz.data();
+  z.avail_out = gz.size();
+  deflate(&z, Z_FINISH);
+  gz.resize(z.total_out);
+  deflateEnd(&z);
+  return gz;
+}
+
+struct Reader
+{
+  const uint8_t* data;
+  size_t length;
+  size_t pos;
+};
+
+static size_t read_memory(void* userdata, void* buffer, size_t size)
+{
+  Reader* reader = (Reader*)userdata;
+  size_t available = reader->length - reader->pos;
+  size = size < available ? size : available;
+  memcpy(buffer, (const void*)(reader->data + reader->pos), size);
+  reader->pos += size;
+  return size;
+}
+
+/* Inflates the whole document into a temporary buffer, then runs both passes */
+static int baseline(const std::vector<uint8_t>& gz, size_t capacity, uint32_t hash, size_t* size)
+{
+  uint8_t* json = (uint8_t*)malloc(capacity + 1);
+
+  z_stream z;
+  memset((void*)&z, 0, sizeof(z));
+  inflateInit2(&z, 15 + 32);
+  z.next_in = (Bytef*)gz.data();
+  z.avail_in = gz.size();
+  z.next_out = json;
+  z.avail_out = capacity;
+  inflate(&z, Z_FINISH);
+  json[z.total_out] = 0;
+  inflateEnd(&z);
+
+  int res = dejson_get_size(size, hash, json);
+
+  if (res == DEJSON_OK)
+  {
+    void* buffer = malloc(*size);
+    res = dejson_deserialize(buffer, hash, json);
+    free(buffer);
+  }
+
+  free((void*)json);
+  return res;
+}
+
+/* Inflates on a separate thread while counting, then deserializes */
+static int streamed(const std::vector<uint8_t>& gz, size_t capacity, uint32_t hash, size_t* size)
+{
+  Reader reader = {gz.data(), gz.size(), 0};
+  dejson_stream_t stream = {read_memory, (void*)&reader, capacity, DEJSON_STREAM_GZIP};
+  uint8_t* json;
+
+  int res = dejson_stream_get_size(size, &json, hash, &stream);
+
+  if (res == DEJSON_OK)
+  {
+    void* buffer = malloc(*size);
+    res = dejson_deserialize(buffer, hash, json);
+    free(buffer);
+    free((void*)json);
+  }
+
+  return res;
+}
+
+template<typename F>
+static double measure(F f, unsigned runs)
+{
+  double best = 1e30;
+
+  for (unsigned i = 0; i < runs; i++)
+  {
+    Clock::time_point start = Clock::now();
+    f();
+    double elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+    best = elapsed < best ? elapsed : best;
+  }
+
+  return best;
+}
+
+int main(int argc, const char* argv[])
+{
+  std::vector<Corpus> corpora;
+
+  for (int i = 1; i < argc; i++)
+  {
+    Corpus corpus = {argv[i], load(argv[i]), g_MetaPatch.name_hash};
+    corpora.push_back(corpus);
+  }
+
+  Corpus patch = {"synthetic Patch", synthesize_patch(100000), g_MetaPatch.name_hash};
+  Corpus unlocks = {"synthetic Unlocks", synthesize_unlocks(1000000), g_MetaUnlocks.name_hash};
+  corpora.push_back(patch);
+  corpora.push_back(unlocks);
+
+  printf("%-24s %12s %12s %14s %14s %14s %14s\n", "corpus", "json bytes", "gzip bytes", "baseline MB/s", "streamed MB/s", "get_size MB/s", "parse MB/s");
+
+  for (size_t i = 0; i < corpora.size(); i++)
+  {
+    const Corpus& corpus = corpora[i];
+    std::vector<uint8_t> gz = gzip(corpus.json);
+    size_t capacity = corpus.json.size();
+    unsigned runs = capacity < 1000000 ? 200 : 5;
+    size_t size1 = 0, size2 = 0;
+    int res1 = 0, res2 = 0;
+
+    double t1 = measure([&]() { res1 = baseline(gz, capacity, corpus.hash, &size1); }, runs);
+    double t2 = measure([&]() { res2 = streamed(gz, capacity, corpus.hash, &size2); }, runs);
+
+    if (res1 != DEJSON_OK || res2 != DEJSON_OK || size1 != size2)
+    {
+      printf("%s: mismatch (%d, %zu) != (%d, %zu)\n", corpus.name.c_str(), res1, size1, res2, size2);
+      return 1;
+    }
+
+    /* The passes alone, without inflating or allocating */
+    const uint8_t* json = (const uint8_t*)corpus.json.c_str();
+    void* buffer = malloc(size1);
+
+    double t3 = measure([&]() { res1 = dejson_get_size(&size2, corpus.hash, json); }, runs);
+    double t4 = measure([&]() { res2 = dejson_deserialize(buffer, corpus.hash, json); }, runs);
+    free(buffer);
+
+    if (res1 != DEJSON_OK || res2 != DEJSON_OK)
+    {
+      printf("%s: parse failed (%d, %d)\n", corpus.name.c_str(), res1, res2);
+      return 1;
+    }
+
+    double mb = capacity / 1e6;
+    printf("%-24s %12zu %12zu %14.1f %14.1f %14.1f %14.1f\n", corpus.name.c_str(), capacity, gz.size(), mb / t1, mb / t2, mb / t3, mb / t4);
+  }
+
+  return 0;
+}
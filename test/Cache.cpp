@@ -0,0 +1,256 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "dejson.h"
+#include "dejson_cache.h"
+#include "RetroAchievements.h"
+
+/* Every field that varies with the version is derived from it, so a document returned for the wrong input shows up as a mismatch */
+static std::string synthesize_patch(unsigned version, unsigned count)
+{
+  char buffer[256];
+  snprintf(buffer, sizeof(buffer), "{\"Success\":true,\"PatchData\":{\"ID\":%u,\"Title\":\"Version %u\",\"Achievements\":[", version, version);
+  std::string json = buffer;
+
+  for (unsigned i = 0; i < count; i++)
+  {
+    snprintf(buffer, sizeof(buffer), "%s{\"ID\":%u,\"Title\":\"Achievement %u\",\"Points\":%u}", i == 0 ? "" : ",", i, version, version);
+    json += buffer;
+  }
+
+  json += "],\"Leaderboards\":[]}}";
+  return json;
+}
+
+static bool check(const Patch* patch, unsigned version, unsigned count)
+{
+  char title[64];
+  snprintf(title, sizeof(title), "Version %u", version);
+
+  if (patch->PatchData.ID != version || strcmp(patch->PatchData.Title.chars, title) != 0 || patch->PatchData.Achievements.count != count)
+  {
+    return false;
+  }
+
+  snprintf(title, sizeof(title), "Achievement %u", version);
+
+  for (unsigned i = 0; i < count; i++)
+  {
+    const Achievement* a = (const Achievement*)DEJSON_GET_ELEMENT(patch->PatchData.Achievements, i);
+
+    if (a->ID != i || a->Points != version || strcmp(a->Title.chars, title) != 0)
+    {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+static int failures = 0;
+
+#define CHECK(x) do { if (!(x)) { printf("%s:%d: %s\n", __FILE__, __LINE__, #x); failures++; } } while (0)
+
+static const Patch* get(dejson_cache_t* cache, const std::string& json)
+{
+  const void* root = NULL;
+  int res = dejson_cache_deserialize(cache, &root, g_MetaPatch.name_hash, (const uint8_t*)json.c_str());
+  return res == DEJSON_OK ? (const Patch*)root : NULL;
+}
+
+static void test_sharing()
+{
+  dejson_cache_t* cache;
+  dejson_cache_stats_t stats;
+
+  CHECK(dejson_cache_create(&cache, 1 << 20) == DEJSON_OK);
+
+  std::string json1 = synthesize_patch(1, 10), json2 = synthesize_patch(2, 10);
+  const Patch* a = get(cache, json1);
+  const Patch* b = get(cache, json1);
+  const Patch* c = get(cache, json2);
+
+  /* Identical inputs share the arena, which holds its own copy of the input */
+  CHECK(a != NULL && a == b && c != NULL && c != a);
+  json1.assign(json1.size(), ' ');
+  CHECK(check(a, 1, 10) && check(c, 2, 10));
+
+  dejson_cache_stats(cache, &stats);
+  CHECK(stats.hits == 1 && stats.misses == 2 && stats.entries == 2);
+
+  /* Errors aren't cached */
+  const void* root;
+  CHECK(dejson_cache_deserialize(cache, &root, g_MetaPatch.name_hash, (const uint8_t*)"{\"PatchData\":[]}") == DEJSON_INVALID_VALUE);
+
+  dejson_cache_release(cache, a);
+  dejson_cache_release(cache, b);
+  dejson_cache_release(cache, c);
+  dejson_cache_destroy(cache);
+}
+
+static void test_eviction()
+{
+  dejson_cache_t* cache;
+  dejson_cache_stats_t stats;
+  std::vector<std::string> jsons;
+
+  for (unsigned i = 0; i < 8; i++)
+  {
+    jsons.push_back(synthesize_patch(i, 20));
+  }
+
+  /* Measure one entry to size the budget for three of them */
+  CHECK(dejson_cache_create(&cache, SIZE_MAX) == DEJSON_OK);
+  dejson_cache_release(cache, get(cache, jsons[0]));
+  dejson_cache_stats(cache, &stats);
+  size_t bytes = stats.bytes;
+  dejson_cache_destroy(cache);
+
+  CHECK(dejson_cache_create(&cache, bytes * 3 + bytes / 2) == DEJSON_OK);
+
+  const Patch* held = get(cache, jsons[0]);
+  dejson_cache_release(cache, get(cache, jsons[1]));
+  dejson_cache_release(cache, get(cache, jsons[2]));
+
+  /* Using the oldest entry makes 1 the least recently used one */
+  dejson_cache_release(cache, get(cache, jsons[0]));
+  dejson_cache_release(cache, get(cache, jsons[3]));
+
+  dejson_cache_stats(cache, &stats);
+  CHECK(stats.entries == 3 && stats.evictions == 1 && stats.bytes <= bytes * 3);
+
+  const Patch* p = get(cache, jsons[1]);
+  dejson_cache_stats(cache, &stats);
+  CHECK(stats.misses == 5 && stats.hits == 1);
+  dejson_cache_release(cache, p);
+
+  /* Entries in use survive their eviction */
+  for (unsigned i = 4; i < 8; i++)
+  {
+    dejson_cache_release(cache, get(cache, jsons[i]));
+  }
+
+  CHECK(check(held, 0, 20));
+  dejson_cache_release(cache, held);
+
+  /* Documents larger than the budget are returned but not kept */
+  std::string large = synthesize_patch(100, 200);
+  p = get(cache, large);
+  CHECK(p != NULL && check(p, 100, 200));
+  dejson_cache_release(cache, p);
+
+  dejson_cache_stats(cache, &stats);
+  CHECK(stats.entries == 3 && stats.bytes <= bytes * 3);
+  dejson_cache_destroy(cache);
+}
+
+static void test_threads(unsigned num_threads, unsigned iterations)
+{
+  dejson_cache_t* cache;
+  std::vector<std::string> jsons;
+
+  for (unsigned i = 0; i < 32; i++)
+  {
+    jsons.push_back(synthesize_patch(i, 1 + i % 7));
+  }
+
+  /* A budget for about half of the documents keeps evictions going */
+  CHECK(dejson_cache_create(&cache, 16 * 1024) == DEJSON_OK);
+
+  std::atomic<unsigned> errors(0);
+  std::vector<std::thread> threads;
+
+  for (unsigned t = 0; t < num_threads; t++)
+  {
+    threads.push_back(std::thread([&, t]() {
+      unsigned seed = t + 1;
+
+      for (unsigned i = 0; i < iterations; i++)
+      {
+        seed = seed * 1103515245 + 12345;
+        unsigned version = (seed >> 16) % jsons.size();
+        const Patch* patch = get(cache, jsons[version]);
+
+        if (patch == NULL || !check(patch, version, 1 + version % 7))
+        {
+          errors++;
+        }
+
+        if (patch != NULL)
+        {
+          dejson_cache_release(cache, patch);
+        }
+      }
+    }));
+  }
+
+  for (std::thread& thread : threads)
+  {
+    thread.join();
+  }
+
+  dejson_cache_stats_t stats;
+  dejson_cache_stats(cache, &stats);
+  CHECK(errors == 0 && stats.hits + stats.misses == (uint64_t)num_threads * iterations);
+  dejson_cache_destroy(cache);
+}
+
+/* Compares a hit with parsing, for a document as large as the ones in test/ */
+static void bench()
+{
+  std::string json = synthesize_patch(1, 200);
+  dejson_cache_t* cache;
+  unsigned runs = 20000;
+
+  dejson_cache_create(&cache, 1 << 20);
+
+  auto t0 = std::chrono::steady_clock::now();
+
+  for (unsigned i = 0; i < runs; i++)
+  {
+    size_t size;
+    dejson_get_size(&size, g_MetaPatch.name_hash, (const uint8_t*)json.c_str());
+    void* buffer = malloc(size);
+    dejson_deserialize(buffer, g_MetaPatch.name_hash, (const uint8_t*)json.c_str());
+    free(buffer);
+  }
+
+  auto t1 = std::chrono::steady_clock::now();
+
+  for (unsigned i = 0; i < runs; i++)
+  {
+    dejson_cache_release(cache, get(cache, json));
+  }
+
+  auto t2 = std::chrono::steady_clock::now();
+
+  dejson_cache_stats_t stats;
+  dejson_cache_stats(cache, &stats);
+  dejson_cache_destroy(cache);
+
+  double parse = std::chrono::duration<double>(t1 - t0).count() * 1e6 / runs;
+  double cached = std::chrono::duration<double>(t2 - t1).count() * 1e6 / runs;
+  printf("%zu bytes: %.2f us parsing, %.2f us cached, %llu hits, %llu misses\n", json.size(), parse, cached, (unsigned long long)stats.hits, (unsigned long long)stats.misses);
+}
+
+int main(int argc, const char* argv[])
+{
+  unsigned num_threads = argc > 1 ? atoi(argv[1]) : 8;
+  unsigned iterations = argc > 2 ? atoi(argv[2]) : 20000;
+
+  test_sharing();
+  test_eviction();
+  test_threads(num_threads, iterations);
+  bench();
+
+  printf("%s\n", failures == 0 ? "ok" : "FAILED");
+  return failures != 0;
+}
@@ -1,8 +1,7 @@
 #include <stdio.h>
 #include <stdint.h>
 
-#include "dejson.h"
-#include "RetroAchievements.h"
+#include "RetroAchievements.hpp"
 
 int main(int argc, const char* argv[])
 {
@@ -23,7 +22,7 @@ int main(int argc, const char* argv[])
 
   {
     size_t size;
-    int res = dejson_get_size(&size, g_MetaPatch.name_hash, json);
+    int res = dejson::get_size<Patch>(&size, json);
 
     if (res != DEJSON_OK)
     {
@@ -31,7 +30,7 @@ int main(int argc, const char* argv[])
       return 1;
     }
 
-    res = dejson_deserialize((void*)buffer, g_MetaPatch.name_hash, json);
+    res = dejson::deserialize<Patch>((void*)buffer, json);
 
     if (res != DEJSON_OK)
     {
@@ -44,52 +43,56 @@ int main(int argc, const char* argv[])
     fclose(file);
   }
   
-  Patch* patch = (Patch*)buffer;
-
-  printf("Success: %s\n", patch->Success ? "true" : "false");
-
-  printf("PatchData.ID = %u\n", patch->PatchData.ID);
-  printf("PatchData.Title = %s\n", patch->PatchData.Title.chars);
-  printf("PatchData.ConsoleID = %u\n", patch->PatchData.ConsoleID);
-  printf("PatchData.ForumTopicID = %u\n", patch->PatchData.ForumTopicID);
-  printf("PatchData.Flags = %u\n", patch->PatchData.Flags);
-  printf("PatchData.ImageIcon = %s\n", patch->PatchData.ImageIcon.chars);
-  printf("PatchData.ImageTitle = %s\n", patch->PatchData.ImageTitle.chars);
-  printf("PatchData.ImageIngame = %s\n", patch->PatchData.ImageIngame.chars);
-  printf("PatchData.ImageBoxArt = %s\n", patch->PatchData.ImageBoxArt.chars);
-  printf("PatchData.Publisher = %s\n", patch->PatchData.Publisher.chars);
-  printf("PatchData.Developer = %s\n", patch->PatchData.Developer.chars);
-  printf("PatchData.Genre = %s\n", patch->PatchData.Genre.chars);
-  printf("PatchData.Released = %s\n", patch->PatchData.Released.chars);
-  printf("PatchData.IsFinal = %s\n", patch->PatchData.IsFinal ? "true" : "false");
-  printf("PatchData.ConsoleName = %s\n", patch->PatchData.ConsoleName.chars);
-  printf("PatchData.RichPresencePatch = %s\n", patch->PatchData.RichPresencePatch ? patch->PatchData.RichPresencePatch->chars : "(null)");
-
-  for (unsigned j = 0; j < patch->PatchData.Achievements.count; j++)
+  RetroAchievements::Patch patch(*(Patch*)buffer);
+  RetroAchievements::PatchData data = patch.PatchData();
+
+  /* Strings are always NUL-terminated, so data() can be printed directly */
+  printf("Success: %s\n", patch.Success() ? "true" : "false");
+
+  printf("PatchData.ID = %u\n", data.ID());
+  printf("PatchData.Title = %s\n", data.Title().data());
+  printf("PatchData.ConsoleID = %u\n", data.ConsoleID());
+  printf("PatchData.ForumTopicID = %u\n", data.ForumTopicID());
+  printf("PatchData.Flags = %u\n", data.Flags());
+  printf("PatchData.ImageIcon = %s\n", data.ImageIcon().data());
+  printf("PatchData.ImageTitle = %s\n", data.ImageTitle().data());
+  printf("PatchData.ImageIngame = %s\n", data.ImageIngame().data());
+  printf("PatchData.ImageBoxArt = %s\n", data.ImageBoxArt().data());
+  printf("PatchData.Publisher = %s\n", data.Publisher().data());
+  printf("PatchData.Developer = %s\n", data.Developer().data());
+  printf("PatchData.Genre = %s\n", data.Genre().data());
+  printf("PatchData.Released = %s\n", data.Released().data());
+  printf("PatchData.IsFinal = %s\n", data.IsFinal() ? "true" : "false");
+  printf("PatchData.ConsoleName = %s\n", dejson::name_of(data.ConsoleName()).data());
+  printf("PatchData.RichPresencePatch = %s\n", data.RichPresencePatch().value_or("(null)").data());
+
+  unsigned j = 0;
+
+  for (RetroAchievements::Achievement a : data.Achievements())
   {
-    Achievement* a = (Achievement*)DEJSON_GET_ELEMENT(patch->PatchData.Achievements, j);
-
-    printf("PatchData.Achievements[%u].ID = %u\n", j, a->ID);
-    printf("PatchData.Achievements[%u].MemAddr = %s\n", j, a->MemAddr.chars);
-    printf("PatchData.Achievements[%u].Title = %s\n", j, a->Title.chars);
-    printf("PatchData.Achievements[%u].Description = %s\n", j, a->Description.chars);
-    printf("PatchData.Achievements[%u].Points = %u\n", j, a->Points);
-    printf("PatchData.Achievements[%u].Author = %s\n", j, a->Author.chars);
-    printf("PatchData.Achievements[%u].Modified = %llu\n", j, a->Modified);
-    printf("PatchData.Achievements[%u].Created = %llu\n", j, a->Created);
-    printf("PatchData.Achievements[%u].BadgeName = %s\n", j, a->BadgeName.chars);
-    printf("PatchData.Achievements[%u].Flags = %u\n", j, a->Flags);
+    printf("PatchData.Achievements[%u].ID = %u\n", j, a.ID());
+    printf("PatchData.Achievements[%u].MemAddr = %s\n", j, a.MemAddr().data());
+    printf("PatchData.Achievements[%u].Title = %s\n", j, a.Title().data());
+    printf("PatchData.Achievements[%u].Description = %s\n", j, a.Description().data());
+    printf("PatchData.Achievements[%u].Points = %u\n", j, a.Points());
+    printf("PatchData.Achievements[%u].Author = %s\n", j, a.Author().data());
+    printf("PatchData.Achievements[%u].Modified = %llu\n", j, (unsigned long long)a.Modified());
+    printf("PatchData.Achievements[%u].Created = %llu\n", j, (unsigned long long)a.Created());
+    printf("PatchData.Achievements[%u].BadgeName = %s\n", j, a.BadgeName().data());
+    printf("PatchData.Achievements[%u].Flags = %u\n", j, a.Flags());
+    j++;
   }
 
-  for (unsigned j = 0; j < patch->PatchData.Leaderboards.count; j++)
-  {
-    Leaderboard* a = (Leaderboard*)DEJSON_GET_ELEMENT(patch->PatchData.Leaderboards, j);
+  j = 0;
 
-    printf("PatchData.Leaderboards[%u].ID = %u\n", j, a->ID);
-    printf("PatchData.Leaderboards[%u].Mem = %s\n", j, a->Mem.chars);
-    printf("PatchData.Leaderboards[%u].Format = %s\n", j, a->Format.chars);
-    printf("PatchData.Leaderboards[%u].Title = %s\n", j, a->Title.chars);
-    printf("PatchData.Leaderboards[%u].Description = %s\n", j, a->Description.chars);
+  for (RetroAchievements::Leaderboard a : data.Leaderboards())
+  {
+    printf("PatchData.Leaderboards[%u].ID = %u\n", j, a.ID());
+    printf("PatchData.Leaderboards[%u].Mem = %s\n", j, a.Mem().data());
+    printf("PatchData.Leaderboards[%u].Format = %s\n", j, dejson::name_of(a.Format()).data());
+    printf("PatchData.Leaderboards[%u].Title = %s\n", j, a.Title().data());
+    printf("PatchData.Leaderboards[%u].Description = %s\n", j, a.Description().data());
+    j++;
   }
 
   //dejson_destroy(&settings);
@@ -0,0 +1,153 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "dejson.h"
+#include "dejson_reload.h"
+#include "RetroAchievements.h"
+
+/* Every field that varies with the version is derived from it, so a torn or freed document shows up as a mismatch */
+static std::string synthesize_patch(unsigned version)
+{
+  char buffer[256];
+  snprintf(buffer, sizeof(buffer), "{\"Success\":true,\"PatchData\":{\"ID\":%u,\"Title\":\"Version %u\",\"Achievements\":[", version, version);
+  std::string json = buffer;
+
+  for (unsigned i = 0; i < 1 + version % 50; i++)
+  {
+    snprintf(buffer, sizeof(buffer), "%s{\"ID\":%u,\"Title\":\"Achievement %u\",\"Points\":%u}", i == 0 ? "" : ",", i, version, version);
+    json += buffer;
+  }
+
+  json += "],\"Leaderboards\":[]}}";
+  return json;
+}
+
+static bool check(const Patch* patch)
+{
+  unsigned version = patch->PatchData.ID;
+  char title[64];
+
+  snprintf(title, sizeof(title), "Version %u", version);
+
+  if (strcmp(patch->PatchData.Title.chars, title) != 0 || patch->PatchData.Achievements.count != 1 + version % 50)
+  {
+    return false;
+  }
+
+  snprintf(title, sizeof(title), "Achievement %u", version);
+
+  for (unsigned i = 0; i < patch->PatchData.Achievements.count; i++)
+  {
+    const Achievement* a = (const Achievement*)DEJSON_GET_ELEMENT(patch->PatchData.Achievements, i);
+
+    if (a->ID != i || a->Points != version || strcmp(a->Title.chars, title) != 0)
+    {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+struct Reader
+{
+  std::thread thread;
+  unsigned long long reads;
+  unsigned errors;
+};
+
+static void read_loop(dejson_reload_t* reload, const std::atomic<bool>& done, Reader& reader)
+{
+  dejson_reader_t* self = dejson_reload_join(reload);
+  unsigned last = 0;
+
+  reader.reads = 0;
+  reader.errors = self == NULL;
+
+  while (self != NULL && !done.load(std::memory_order_relaxed))
+  {
+    const Patch* patch = (const Patch*)dejson_reload_enter(self);
+
+    if (patch != NULL)
+    {
+      /* Versions must never go back */
+      if (!check(patch) || patch->PatchData.ID < last)
+      {
+        reader.errors++;
+      }
+
+      last = patch->PatchData.ID;
+      reader.reads++;
+    }
+
+    dejson_reload_leave(self);
+  }
+
+  if (self != NULL)
+  {
+    dejson_reload_quit(self);
+  }
+}
+
+int main(int argc, const char* argv[])
+{
+  unsigned num_readers = argc > 1 ? atoi(argv[1]) : 8;
+  unsigned versions = argc > 2 ? atoi(argv[2]) : 5000;
+
+  dejson_reload_t* reload;
+
+  if (dejson_reload_create(&reload, g_MetaPatch.name_hash, num_readers) != DEJSON_OK)
+  {
+    fprintf(stderr, "out of memory\n");
+    return 1;
+  }
+
+  std::atomic<bool> done(false);
+  std::vector<Reader> readers(num_readers);
+
+  for (Reader& reader : readers)
+  {
+    reader.thread = std::thread(read_loop, reload, std::cref(done), std::ref(reader));
+  }
+
+  int failed = 0;
+  auto t0 = std::chrono::steady_clock::now();
+
+  for (unsigned version = 1; version <= versions; version++)
+  {
+    std::string json = synthesize_patch(version);
+
+    if (dejson_reload_update(reload, (const uint8_t*)json.c_str()) != DEJSON_OK)
+    {
+      failed = 1;
+      break;
+    }
+  }
+
+  double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+  done = true;
+
+  unsigned long long reads = 0;
+  unsigned errors = 0;
+
+  for (Reader& reader : readers)
+  {
+    reader.thread.join();
+    reads += reader.reads;
+    errors += reader.errors;
+  }
+
+  dejson_reload_destroy(reload);
+
+  failed |= errors != 0;
+  printf("%u readers, %u versions in %.3f s, %llu reads, %u errors: %s\n", num_readers, versions, seconds, reads, errors, failed ? "FAILED" : "ok");
+  return failed;
+}
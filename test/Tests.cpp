@@ -0,0 +1,1112 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <algorithm>
+#include <initializer_list>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "Test.hpp"
+
+static int failures = 0;
+
+#define CHECK(x) do { if (!(x)) { printf("%s:%d: %s\n", __FILE__, __LINE__, #x); failures++; } } while (0)
+
+template<typename T>
+static dejson::document<T> parse(const char* json)
+{
+  return dejson::deserialize<T>((const uint8_t*)json);
+}
+
+template<typename T>
+static int error_of(const char* json)
+{
+  size_t size;
+  return dejson::get_size<T>(&size, (const uint8_t*)json);
+}
+
+static void test_maps()
+{
+  dejson::document<Maps> doc = parse<Maps>("{\"Counts\":{\"a\":1,\"b\":2,\"a\":3},\"Counters\":{\"x\":{\"Value\":7,\"Name\":\"seven\"}}}");
+  CHECK(doc);
+
+  Test::Maps maps = doc.view();
+  dejson::map_view<unsigned, unsigned> counts = maps.Counts();
+
+  /* Duplicated keys keep the position of their first appearance, and the last value wins */
+  CHECK(counts.size() == 2);
+  CHECK(counts.key(0) == "a" && counts.value(0) == 3);
+  CHECK(counts.key(1) == "b" && counts.value(1) == 2);
+  CHECK(counts.find("a").value_or(0) == 3 && counts.find("b").value_or(0) == 2);
+  CHECK(!counts.find("c").has_value() && !counts.find("").has_value());
+
+  CHECK(maps.Counters().size() == 1);
+  CHECK(maps.Counters().find("x").has_value() && maps.Counters().find("x")->Value() == 7);
+  CHECK(maps.Counters().value(0).Name() == "seven");
+
+  /* Empty maps can be looked up */
+  doc = parse<Maps>("{\"Counts\":{},\"Counters\":{ }}");
+  CHECK(doc && doc.view().Counts().empty() && doc.view().Counters().empty());
+  CHECK(!doc.view().Counts().find("a").has_value());
+  CHECK(dejson_map_find(&doc->Counts, "a", 1) == NULL);
+
+  /* Missing maps are zeroed and have no slots */
+  doc = parse<Maps>("{}");
+  CHECK(doc && doc->Counts.count == 0 && doc->Counts.capacity == 0);
+  CHECK(dejson_map_find(&doc->Counts, "a", 1) == NULL);
+
+  /* Escaped keys are decoded, including NULs, and their length doesn't stop there */
+  doc = parse<Maps>("{\"Counts\":{\"a\\u0000b\":1,\"a\":2,\"\\u00e9\":3,\"\\ud83d\\ude00\":4}}");
+  CHECK(doc && doc->Counts.count == 4);
+  CHECK(doc.view().Counts().key(0) == std::string_view("a\0b", 3));
+  CHECK(doc.view().Counts().find(std::string_view("a\0b", 3)).value_or(0) == 1);
+  CHECK(doc.view().Counts().find("a").value_or(0) == 2);
+  CHECK(doc.view().Counts().find("\xc3\xa9").value_or(0) == 3);
+  CHECK(doc.view().Counts().find("\xf0\x9f\x98\x80").value_or(0) == 4);
+
+  /* Tables grow with the number of keys, and keep every one of them */
+  std::string json = "{\"Counts\":{";
+
+  for (unsigned i = 0; i < 1000; i++)
+  {
+    json += (i == 0 ? "\"k" : ",\"k") + std::to_string(i) + "\":" + std::to_string(i);
+  }
+
+  json += "}}";
+  doc = parse<Maps>(json.c_str());
+  CHECK(doc && doc->Counts.count == 1000 && doc->Counts.capacity >= 2000);
+  unsigned found = 0;
+
+  for (unsigned i = 0; i < 1000; i++)
+  {
+    std::string key = "k" + std::to_string(i);
+    found += doc.view().Counts().find(key).value_or(UINT32_MAX) == i;
+  }
+
+  CHECK(found == 1000);
+
+  CHECK(error_of<Maps>("{\"Counts\":[]}") == DEJSON_INVALID_VALUE);
+  CHECK(error_of<Maps>("{\"Counts\":{1:2}}") != DEJSON_OK);
+  CHECK(error_of<Maps>("{\"Counts\":{\"a\" 2}}") != DEJSON_OK);
+  CHECK(error_of<Maps>("{\"Counts\":{\"a\":2") != DEJSON_OK);
+  CHECK(error_of<Maps>("{\"Counts\":{\"a\\u12\":2}}") == DEJSON_INVALID_ESCAPE);
+  CHECK(error_of<Maps>("{\"Counts\":{\"a\\ud800\":2}}") == DEJSON_INVALID_ESCAPE);
+}
+
+static void test_indexed_arrays()
+{
+  dejson::document<Catalog> doc = parse<Catalog>(
+    "{\"ById\":[{\"Id\":3,\"Name\":\"c\"},{\"Id\":1,\"Name\":\"a\"},{\"Id\":3,\"Name\":\"dup\"}],"
+    "\"ByName\":[{\"Id\":1,\"Name\":\"one\"},{\"Id\":2},{\"Id\":3,\"Name\":\"th\\u0072ee\"}],"
+    "\"ByCode\":[{\"Code\":-5,\"Id\":1},{\"Code\":300,\"Id\":2}],"
+    "\"Plain\":[{\"Id\":9}]}");
+
+  CHECK(doc);
+  Test::Catalog catalog = doc.view();
+
+  /* Elements stay in document order, and the first one wins on duplicated keys */
+  CHECK(catalog.ById().size() == 3 && catalog.ById()[2].Name() == "dup");
+  CHECK(catalog.ById_find_by_Id(3).has_value() && catalog.ById_find_by_Id(3)->Name() == "c");
+  CHECK(catalog.ById_find_by_Id(1).has_value() && catalog.ById_find_by_Id(1)->Name() == "a");
+  CHECK(!catalog.ById_find_by_Id(2).has_value() && !catalog.ById_find_by_Id(0).has_value());
+
+  /* String keys are compared decoded, and elements without the key aren't indexed */
+  CHECK(catalog.ByName_find_by_Name("one").has_value() && catalog.ByName_find_by_Name("one")->Id() == 1);
+  CHECK(catalog.ByName_find_by_Name("three").has_value() && catalog.ByName_find_by_Name("three")->Id() == 3);
+  CHECK(!catalog.ByName_find_by_Name("").has_value() && !catalog.ByName_find_by_Name(NULL).has_value());
+
+  int16_t code = -5;
+  CHECK(Item_find_by_Code(&doc->ByCode, -5) != NULL && Item_find_by_Code(&doc->ByCode, 300)->Id == 2);
+  CHECK(dejson_index_find(&doc->ByCode, &code) == DEJSON_GET_ELEMENT(doc->ByCode, 0));
+  CHECK(doc->ByCode.capacity >= 4 && doc->ByCode.key_type == DEJSON_TYPE_INT16);
+  CHECK(doc.view().Plain().size() == 1 && doc.view().Plain()[0].Id() == 9);
+
+  /* Empty and missing arrays find nothing */
+  doc = parse<Catalog>("{\"ById\":[],\"ByName\":[]}");
+  CHECK(doc && doc.view().ById().empty() && !doc.view().ById_find_by_Id(0).has_value());
+  CHECK(!doc.view().ByName_find_by_Name("").has_value() && !doc.view().ByCode_find_by_Code(0).has_value());
+
+  /* Every element is found in large arrays */
+  std::string json = "{\"ById\":[";
+
+  for (unsigned i = 0; i < 1000; i++)
+  {
+    json += (i == 0 ? "{\"Id\":" : ",{\"Id\":") + std::to_string(i * 7) + ",\"Name\":\"" + std::to_string(i) + "\"}";
+  }
+
+  json += "]}";
+  doc = parse<Catalog>(json.c_str());
+  CHECK(doc && doc->ById.count == 1000);
+  unsigned found = 0;
+
+  for (unsigned i = 0; i < 1000; i++)
+  {
+    std::optional<Test::Item> item = doc.view().ById_find_by_Id(i * 7);
+    found += item.has_value() && item->Name() == std::to_string(i) && !doc.view().ById_find_by_Id(i * 7 + 1).has_value();
+  }
+
+  CHECK(found == 1000);
+  CHECK(error_of<Catalog>("{\"ById\":[{\"Id\":1},2]}") == DEJSON_INVALID_VALUE);
+}
+
+/* A document with the overflow buffers of the patches applied to it */
+template<typename T>
+struct patched
+{
+  explicit patched(const char* json) : doc(dejson::deserialize<T>((const uint8_t*)json)) {}
+
+  dejson::document<T> doc;
+  std::vector<std::unique_ptr<uint8_t[]>> overflows;
+};
+
+/* Applies patch with an overflow buffer of shrink bytes less than dejson_get_patch_size, or returns -1 if it's smaller */
+template<typename T>
+static int patch_once(patched<T>& p, const char* patch, size_t shrink)
+{
+  uint32_t hash = dejson::meta_of<T>::get()->name_hash;
+  size_t size;
+  int res = dejson_get_patch_size(&size, (const void*)p.doc.get(), hash, (const uint8_t*)patch);
+
+  if (res != DEJSON_OK)
+  {
+    return res;
+  }
+  else if (size < shrink)
+  {
+    return -1;
+  }
+
+  p.overflows.emplace_back(new uint8_t[size - shrink + 1]);
+  return dejson_apply_patch((void*)p.doc.get(), (void*)p.overflows.back().get(), size - shrink, hash, (const uint8_t*)patch);
+}
+
+/*
+Deserializes json and applies the patches in order, stopping at the first error.
+Each patch is also replayed on a fresh copy with one byte less than
+dejson_get_patch_size, which must not be enough since the size is exact.
+*/
+template<typename T>
+static int apply(patched<T>& p, const char* json, std::initializer_list<const char*> patches)
+{
+  size_t done = 0;
+
+  for (const char* patch : patches)
+  {
+    patched<T> copy(json);
+    size_t i = 0;
+
+    for (const char* previous : patches)
+    {
+      if (i++ == done)
+      {
+        break;
+      }
+
+      patch_once(copy, previous, 0);
+    }
+
+    int res = patch_once(copy, patch, 1);
+    CHECK(res != DEJSON_OK);
+
+    res = patch_once(p, patch, 0);
+
+    if (res != DEJSON_OK)
+    {
+      return res;
+    }
+
+    done++;
+  }
+
+  return DEJSON_OK;
+}
+
+static void test_patches()
+{
+  const char* profile = "{\"Name\":\"a\",\"Settings\":{\"Volume\":1,\"Theme\":\"dark\",\"Levels\":[1,2,3]},\"Backup\":{\"Volume\":5}}";
+
+  {
+    /* null removes, objects merge recursively, and arrays are replaced */
+    patched<Profile> p(profile);
+    CHECK(apply(p, profile, {"{\"Name\":null,\"Backup\":null,\"Settings\":{\"Volume\":2,\"Levels\":[4]}}"}) == DEJSON_OK);
+
+    Test::Profile view = p.doc.view();
+    CHECK(p.doc->Name.chars == NULL && p.doc->Backup == NULL);
+    CHECK(view.Settings().Volume() == 2 && view.Settings().Theme() == "dark");
+    CHECK(view.Settings().Levels().size() == 1 && view.Settings().Levels()[0] == 4);
+  }
+
+  {
+    /* Missing pointers are allocated zeroed before merging, and existing ones are merged into */
+    patched<Profile> p("{}");
+    CHECK(apply(p, "{}", {"{\"Backup\":{\"Theme\":\"x\"}}", "{\"Backup\":{\"Volume\":3}}", "{\"Name\":\"b\"}"}) == DEJSON_OK);
+    CHECK(p.doc->Backup != NULL && p.doc->Backup->Volume == 3 && strcmp(p.doc->Backup->Theme.chars, "x") == 0);
+    CHECK(strcmp(p.doc->Name.chars, "b") == 0);
+  }
+
+  {
+    /* Only the last value of a repeated key is applied */
+    patched<Profile> p(profile);
+    CHECK(apply(p, profile, {"{\"Settings\":{\"Volume\":7},\"Settings\":{\"Theme\":\"light\"},\"Name\":\"c\",\"Name\":null}"}) == DEJSON_OK);
+    CHECK(p.doc->Settings.Volume == 1 && strcmp(p.doc->Settings.Theme.chars, "light") == 0 && p.doc->Name.chars == NULL);
+  }
+
+  const char* maps = "{\"Counts\":{\"a\":1,\"b\":2,\"c\":3}}";
+
+  {
+    /* Removed keys are replaced by the last entry, and new keys are appended */
+    patched<Maps> p(maps);
+    CHECK(apply(p, maps, {"{\"Counts\":{\"b\":null,\"d\":4,\"a\":10,\"z\":null}}"}) == DEJSON_OK);
+
+    dejson::map_view<unsigned, unsigned> counts = p.doc.view().Counts();
+    CHECK(counts.size() == 3 && !counts.find("b").has_value());
+    CHECK(counts.key(0) == "a" && counts.value(0) == 10);
+    CHECK(counts.key(1) == "c" && counts.value(1) == 3);
+    CHECK(counts.key(2) == "d" && counts.value(2) == 4);
+    CHECK(counts.find("d").value_or(0) == 4);
+  }
+
+  {
+    /* Deleting and adding a key back in the same patch */
+    patched<Maps> p(maps);
+    CHECK(apply(p, maps, {"{\"Counts\":{\"x\":null,\"x\":5}}", "{\"Counts\":{\"a\":null,\"a\":6}}", "{\"Counts\":{\"b\":7,\"\\u0062\":null}}"}) == DEJSON_OK);
+
+    dejson::map_view<unsigned, unsigned> counts = p.doc.view().Counts();
+    CHECK(counts.size() == 3 && counts.find("x").value_or(0) == 5 && counts.find("a").value_or(0) == 6);
+    CHECK(!counts.find("b").has_value() && counts.find("c").value_or(0) == 3);
+  }
+
+  {
+    /* Values of existing keys are updated where they are, and maps only move when they're out of room */
+    patched<Maps> p(maps);
+    const void* entries = p.doc->Counts.entries;
+    size_t size;
+
+    CHECK(dejson_get_patch_size(&size, (const void*)p.doc.get(), g_MetaMaps.name_hash, (const uint8_t*)"{\"Counts\":{\"c\":30}}") == DEJSON_OK && size == 0);
+    CHECK(apply(p, maps, {"{\"Counts\":{\"c\":30}}"}) == DEJSON_OK);
+    CHECK(p.doc->Counts.entries == entries && p.doc.view().Counts().find("c").value_or(0) == 30);
+
+    CHECK(apply(p, maps, {"{\"Counts\":{\"c\":30}}", "{\"Counts\":{\"d\":4}}"}) == DEJSON_OK);
+    CHECK(p.doc->Counts.entries != entries && p.doc->Counts.room >= 6);
+
+    entries = p.doc->Counts.entries;
+    CHECK(apply(p, maps, {"{\"Counts\":{\"c\":30}}", "{\"Counts\":{\"d\":4}}", "{\"Counts\":{\"e\":5}}"}) == DEJSON_OK);
+    CHECK(p.doc->Counts.entries == entries && p.doc->Counts.count == 5);
+  }
+
+  {
+    /* Maps of records are merged per key */
+    const char* named = "{\"Named\":{\"k\":{\"Volume\":1,\"Theme\":\"t\"}}}";
+    patched<Profile> p(named);
+    CHECK(apply(p, named, {"{\"Named\":{\"k\":{\"Volume\":2},\"n\":{\"Theme\":\"new\",\"Levels\":[1]}}}"}) == DEJSON_OK);
+
+    Test::Profile view = p.doc.view();
+    CHECK(view.Named().size() == 2);
+    CHECK(view.Named().find("k").has_value() && view.Named().find("k")->Volume() == 2 && view.Named().find("k")->Theme() == "t");
+    CHECK(view.Named().find("n").has_value() && view.Named().find("n")->Theme() == "new" && view.Named().find("n")->Levels().size() == 1);
+  }
+
+  {
+    /* Keys added one patch at a time, then half of them removed at once */
+    patched<Maps> p("{}");
+    unsigned i, found = 0, moves = 0;
+    const void* entries = NULL;
+
+    for (i = 0; i < 200; i++)
+    {
+      std::string patch = "{\"Counts\":{\"k" + std::to_string(i) + "\":" + std::to_string(i) + "}}";
+      CHECK(patch_once(p, patch.c_str(), 0) == DEJSON_OK);
+      moves += p.doc->Counts.entries != entries;
+      entries = p.doc->Counts.entries;
+    }
+
+    CHECK(p.doc->Counts.count == 200 && moves <= 9);
+
+    std::string patch = "{\"Counts\":{";
+
+    for (i = 0; i < 200; i += 2)
+    {
+      patch += (i == 0 ? "\"k" : ",\"k") + std::to_string(i) + "\":null";
+    }
+
+    patch += "}}";
+    CHECK(patch_once(p, patch.c_str(), 0) == DEJSON_OK);
+
+    for (i = 0; i < 200; i++)
+    {
+      std::optional<unsigned> value = p.doc.view().Counts().find("k" + std::to_string(i));
+      found += (i & 1) != 0 ? value.value_or(UINT32_MAX) == i : !value.has_value();
+    }
+
+    CHECK(p.doc->Counts.count == 100 && found == 200);
+  }
+
+  {
+    /* Invalid patches are reported by both functions */
+    patched<Maps> p(maps);
+    CHECK(apply(p, maps, {"{\"Counts\":{\"a\":}}"}) == DEJSON_INVALID_VALUE);
+    CHECK(apply(p, maps, {"{\"Counts\":[]}"}) == DEJSON_INVALID_VALUE);
+    CHECK(apply(p, maps, {"[]"}) == DEJSON_INVALID_VALUE);
+    CHECK(apply(p, maps, {"{\"Counts\":{\"a\":1}} x"}) == DEJSON_EOF_EXPECTED);
+    CHECK(p.doc.view().Counts().find("a").value_or(0) == 1);
+  }
+}
+
+static std::string nest(const char* open, const char* close, unsigned depth, const char* inner)
+{
+  std::string json;
+
+  for (unsigned i = 0; i < depth; i++)
+  {
+    json += open;
+  }
+
+  json += inner;
+
+  for (unsigned i = 0; i < depth; i++)
+  {
+    json += close;
+  }
+
+  return json;
+}
+
+/* Returns the error of json if get_size, deserialize and validate agree on it, or -1 */
+template<typename T>
+static int depth_error(const std::string& json)
+{
+  int res = error_of<T>(json.c_str());
+  int validated = dejson_validate(dejson::meta_of<T>::get()->name_hash, (const uint8_t*)json.c_str(), json.size());
+  return parse<T>(json.c_str()).error() == res && validated == res ? res : -1;
+}
+
+static void test_depth()
+{
+  /* The root object counts as one level */
+  std::string json = "{\"Unknown\":" + nest("[", "]", DEJSON_MAX_DEPTH - 1, "") + "}";
+  CHECK(error_of<Counter>(json.c_str()) == DEJSON_OK);
+  CHECK(dejson_validate(g_MetaCounter.name_hash, (const uint8_t*)json.c_str(), json.size()) == DEJSON_OK);
+
+  json = "{\"Unknown\":" + nest("[", "]", DEJSON_MAX_DEPTH, "") + "}";
+  CHECK(error_of<Counter>(json.c_str()) == DEJSON_TOO_DEEP);
+  CHECK(dejson_validate(g_MetaCounter.name_hash, (const uint8_t*)json.c_str(), json.size()) == DEJSON_TOO_DEEP);
+
+  json = "{\"Unknown\":" + nest("[{\"a\":", "}]", 5000, "1") + "}";
+  CHECK(error_of<Counter>(json.c_str()) == DEJSON_TOO_DEEP);
+
+  /* Nested records and maps count too */
+  json = nest("{\"Value\":1,\"Next\":", "}", DEJSON_MAX_DEPTH - 1, "null") + "}";
+  json.erase(json.size() - 1);
+  CHECK(parse<Node>(json.c_str()).error() == DEJSON_OK);
+
+  json = nest("{\"Value\":1,\"Next\":", "}", 5000, "null");
+  CHECK(parse<Node>(json.c_str()).error() == DEJSON_TOO_DEEP);
+
+  json = "{\"Counters\":{\"a\":{\"Name\":" + nest("[", "]", DEJSON_MAX_DEPTH, "") + "}}}";
+  CHECK(error_of<Maps>(json.c_str()) == DEJSON_TOO_DEEP);
+
+  /* Arrays and maps that are parsed, and prescanned, count once, the same in every entry point */
+  CHECK(depth_error<Envelope>("{\"Items\":[" + nest("[", "]", DEJSON_MAX_DEPTH - 2, "") + "]}") == DEJSON_OK);
+  CHECK(depth_error<Envelope>("{\"Items\":[" + nest("[", "]", DEJSON_MAX_DEPTH - 1, "") + "]}") == DEJSON_TOO_DEEP);
+  CHECK(depth_error<Profile>("{\"Named\":{\"a\":{\"Unknown\":" + nest("[", "]", DEJSON_MAX_DEPTH - 3, "") + "}}}") == DEJSON_OK);
+  CHECK(depth_error<Profile>("{\"Named\":{\"a\":{\"Unknown\":" + nest("[", "]", DEJSON_MAX_DEPTH - 2, "") + "}}}") == DEJSON_TOO_DEEP);
+
+  /* And patches */
+  dejson::document<Node> node = parse<Node>("{\"Value\":1}");
+  size_t size;
+  json = nest("{\"Next\":", "}", 5000, "null");
+  CHECK(dejson_get_patch_size(&size, (const void*)node.get(), g_MetaNode.name_hash, (const uint8_t*)json.c_str()) == DEJSON_TOO_DEEP);
+}
+
+static void test_enums()
+{
+  dejson::document<Palette> doc = parse<Palette>(
+    "{\"Main\":\"Green\",\"Colors\":[\"Red\",\"dark red\",\"Purple\",\"Blue\"],\"Accent\":\"say \\\"hi\\\"\","
+    "\"Named\":{\"a\":\"Blue\",\"b\":\"\"},\"Wide\":\"W299\"}");
+  CHECK(doc);
+
+  Test::Palette view = doc.view();
+  CHECK(view.Main() == Color_Green && view.Accent().value_or(Color_UNKNOWN) == Color_Quoted);
+  CHECK(view.Colors().size() == 4 && view.Colors()[0] == Color_Red && view.Colors()[1] == Color_DarkRed);
+  CHECK(view.Colors()[2] == Color_UNKNOWN && view.Colors()[3] == Color_Blue);
+  CHECK(view.Named().find("a").value_or(Color_UNKNOWN) == Color_Blue && view.Named().find("b").value_or(Color_Red) == Color_UNKNOWN);
+  CHECK(view.Wide() == Wide_W299 && sizeof(doc->Wide) == 2 && sizeof(doc->Main) == 1);
+
+  /* Names are compared decoded, and a name with the right hash but a different length or content is unknown */
+  doc = parse<Palette>("{\"Main\":\"\\u0052ed\",\"Accent\":\"dark\\u0020red\",\"Wide\":\"W29\"}");
+  CHECK(doc && doc->Main == Color_Red && doc.view().Accent().value_or(Color_UNKNOWN) == Color_DarkRed && doc->Wide == Wide_UNKNOWN);
+  CHECK(parse<Palette>("{\"Main\":\"red\"}")->Main == Color_UNKNOWN);
+  CHECK(parse<Palette>("{\"Main\":\"Red \"}")->Main == Color_UNKNOWN);
+  CHECK(parse<Palette>("{\"Main\":\"Re\"}")->Main == Color_UNKNOWN);
+
+  /* Every name is found in its own slot of the perfect hash */
+  unsigned found = 0;
+
+  for (uint32_t value = 1; value <= g_MetaWide.count; value++)
+  {
+    std::string json = std::string("{\"Wide\":\"") + dejson_enum_name(&g_MetaWide, value) + "\"}";
+    found += parse<Palette>(json.c_str())->Wide == value;
+  }
+
+  CHECK(g_MetaWide.count == 300 && found == 300);
+
+  for (uint32_t value = 1; value <= g_MetaColor.count; value++)
+  {
+    std::string json = std::string("{\"Main\":\"") + dejson_enum_name(&g_MetaColor, value) + "\"}";
+    json = value == Color_Quoted ? "{\"Main\":\"say \\\"hi\\\"\"}" : json;
+    CHECK(parse<Palette>(json.c_str())->Main == value);
+  }
+
+  /* Names back from values, with nothing for unknown ones */
+  CHECK(dejson::name_of(Color_DarkRed) == "dark red" && dejson::name_of(Color_Quoted) == "say \"hi\"");
+  CHECK(dejson::name_of(Wide_W000) == "W000" && dejson::name_of(Wide_W299) == "W299");
+  CHECK(dejson::name_of(Color_UNKNOWN).empty() && dejson_enum_name(&g_MetaColor, g_MetaColor.count + 1) == NULL);
+
+  CHECK(error_of<Palette>("{\"Main\":1}") == DEJSON_INVALID_VALUE);
+  CHECK(error_of<Palette>("{\"Main\":null}") == DEJSON_INVALID_VALUE);
+  CHECK(error_of<Palette>("{\"Colors\":[\"Red\",2]}") == DEJSON_INVALID_VALUE);
+  CHECK(error_of<Palette>("{\"Main\":\"Red}") != DEJSON_OK);
+}
+
+static unsigned hex_calls = 0;
+
+/* Reads up to eight hex digits, rejecting anything else, including escapes */
+int parse_hex(void* value, const char* chars, size_t length)
+{
+  uint32_t result = 0;
+  hex_calls++;
+
+  if (length == 0 || length > 8)
+  {
+    return 0;
+  }
+
+  for (size_t i = 0; i < length; i++)
+  {
+    char c = chars[i];
+    unsigned digit = c >= '0' && c <= '9' ? c - '0' : c >= 'a' && c <= 'f' ? c - 'a' + 10 : 16;
+
+    if (digit == 16)
+    {
+      return 0;
+    }
+
+    result = result << 4 | digit;
+  }
+
+  *(uint32_t*)value = result;
+  return 1;
+}
+
+static void test_quoted()
+{
+  dejson::document<Quoted> doc = parse<Quoted>(
+    "{\"Id\":\"228\",\"Flag\":\"true\",\"Ratio\":\"0.5\",\"Big\":\"-9007199254740993\",\"Ids\":[\"1\",2,\"3\"]}");
+  CHECK(doc);
+  CHECK(doc->Id == 228 && doc->Flag && doc->Ratio == 0.5 && doc->Big == -9007199254740993LL);
+  CHECK(doc.view().Ids().size() == 3 && doc.view().Ids()[0] == 1 && doc.view().Ids()[1] == 2 && doc.view().Ids()[2] == 3);
+
+  /* Quoted fields still take their values unquoted */
+  doc = parse<Quoted>("{\"Id\":7,\"Flag\":false,\"Ratio\":1e2,\"Big\":1}");
+  CHECK(doc && doc->Id == 7 && !doc->Flag && doc->Ratio == 100.0 && doc->Big == 1);
+
+  doc = parse<Quoted>("{ \"Id\" : \"228\" , \"Flag\" : \"false\" }");
+  CHECK(doc && doc->Id == 228 && !doc->Flag);
+
+  CHECK(error_of<Quoted>("{\"Id\":\"\"}") == DEJSON_INVALID_VALUE);
+  CHECK(error_of<Quoted>("{\"Id\":\"22x\"}") == DEJSON_INVALID_VALUE);
+  CHECK(error_of<Quoted>("{\"Id\":\"228\"x}") != DEJSON_OK);
+  CHECK(error_of<Quoted>("{\"Id\":\"228}") != DEJSON_OK);
+  CHECK(error_of<Quoted>("{\"Flag\":\"yes\"}") != DEJSON_OK);
+  CHECK(error_of<Quoted>("{\"Ids\":[\"1\",\"a\"]}") != DEJSON_OK);
+
+  /* Converters get the characters between the quotes, and are called while counting too */
+  hex_calls = 0;
+  doc = parse<Quoted>("{\"Hex\":\"ff\",\"Hexes\":[\"1\",\"a0\",\"deadbeef\"],\"MaybeHex\":\"10\"}");
+  CHECK(doc && doc->Hex == 0xff && doc.view().MaybeHex().value_or(0) == 0x10);
+  CHECK(doc.view().Hexes().size() == 3 && doc.view().Hexes()[1] == 0xa0 && doc.view().Hexes()[2] == 0xdeadbeef);
+  CHECK(hex_calls == 10);
+
+  doc = parse<Quoted>("{\"MaybeHex\":null}");
+  CHECK(doc && !doc.view().MaybeHex().has_value() && doc->Hex == 0);
+
+  /* Escapes are passed as they are */
+  CHECK(error_of<Quoted>("{\"Hex\":\"\\u0061\"}") == DEJSON_INVALID_VALUE);
+  CHECK(error_of<Quoted>("{\"Hex\":\"\"}") == DEJSON_INVALID_VALUE);
+  CHECK(error_of<Quoted>("{\"Hex\":\"123456789\"}") == DEJSON_INVALID_VALUE);
+  CHECK(error_of<Quoted>("{\"Hex\":255}") == DEJSON_INVALID_VALUE);
+  CHECK(error_of<Quoted>("{\"Hexes\":[\"1\",2]}") == DEJSON_INVALID_VALUE);
+  CHECK(error_of<Quoted>("{\"Hex\":\"ff}") != DEJSON_OK);
+}
+
+template<typename T>
+static int validate(const std::string& json)
+{
+  return dejson_validate(T::name_hash, (const uint8_t*)json.c_str(), json.size());
+}
+
+static void test_validate()
+{
+  /* Validation returns the same error as counting, for good and bad documents alike */
+  static const char* const documents[] =
+  {
+    "{\"Value\":1,\"Name\":\"a\",\"Unknown\":[1,{\"b\":[true,null]},\"c\"]}",
+    "{}", " { } ", "[]", "", "{\"Value\":1} x", "{\"Value\":}", "{\"Value\":1,}", "{\"Value\" 1}",
+    "{\"Value\":1", "{\"Value", "{\"Name\":\"a", "{\"Name\":1}", "{\"Name\":\"\\x\"}", "{\"Unknown\":[1,2}",
+    "{\"Unknown\":{\"a\":1]}", "{\"Unknown\":tru}", "{\"Unknown\":-}", "{\"Unknown\":\"\\ud800\"}",
+  };
+
+  for (const char* json : documents)
+  {
+    CHECK(validate<Test::Counter>(json) == error_of<Counter>(json));
+  }
+
+  CHECK(validate<Test::Counter>("{\"Value\":1,\"Name\":\"a\"}") == DEJSON_OK);
+  CHECK(validate<Test::Maps>("{\"Counts\":{\"a\":1},\"Counters\":{\"b\":{\"Value\":2}}}") == DEJSON_OK);
+  CHECK(validate<Test::Catalog>("{\"ById\":[{\"Id\":1}],\"Plain\":[]}") == DEJSON_OK);
+  CHECK(validate<Test::Maps>("{\"Counts\":[]}") == DEJSON_INVALID_VALUE);
+
+  /* A NUL before length ends the document early */
+  CHECK(validate<Test::Counter>(std::string("{}\0 ", 4)) == DEJSON_EOF_EXPECTED);
+  CHECK(validate<Test::Counter>(std::string("{\"Name\":\"a\0\"}", 12)) == DEJSON_UNTERMINATED_STRING);
+
+  /* Well-formed sequences of every length, and a code point escaped instead */
+  static const char* const valid[] =
+  {
+    "\x7f", "\xc2\x80", "\xdf\xbf", "\xe0\xa0\x80", "\xed\x9f\xbf", "\xee\x80\x80", "\xef\xbf\xbf",
+    "\xf0\x90\x80\x80", "\xf4\x8f\xbf\xbf", "\\ud83d\\ude00",
+  };
+
+  /* Stray continuation bytes, overlong forms, surrogates, code points past U+10FFFF and truncated sequences */
+  static const char* const invalid[] =
+  {
+    "\x80", "\xbf", "\xc0\xaf", "\xc1\xbf", "\xe0\x80\xaf", "\xe0\x9f\xbf", "\xed\xa0\x80", "\xed\xbf\xbf",
+    "\xf0\x80\x80\x80", "\xf0\x8f\xbf\xbf", "\xf4\x90\x80\x80", "\xf5\x80\x80\x80", "\xff", "\xc2", "\xe2\x82",
+    "\xf0\x9f\x98", "\xc2\x41", "\xe2\x28\xa1",
+  };
+
+  /* The padding moves the sequence across the 16-byte blocks scanned with SSE2 */
+  unsigned mismatches = 0;
+
+  for (size_t pad = 0; pad < 40; pad++)
+  {
+    std::string before(pad, 'a');
+
+    for (const char* str : valid)
+    {
+      mismatches += validate<Test::Counter>("{\"Name\":\"" + before + str + "z\"}") != DEJSON_OK;
+      mismatches += validate<Test::Maps>("{\"Counts\":{\"" + before + str + "\":1}}") != DEJSON_OK;
+      mismatches += validate<Test::Counter>("{\"Unknown\":[\"" + before + str + "\"]}") != DEJSON_OK;
+    }
+
+    for (const char* str : invalid)
+    {
+      std::string name = "{\"Name\":\"" + before + str + "z\"}";
+      mismatches += validate<Test::Counter>(name) != DEJSON_INVALID_UTF8;
+      mismatches += error_of<Counter>(name.c_str()) != DEJSON_INVALID_UTF8;
+      mismatches += validate<Test::Maps>("{\"Counts\":{\"" + before + str + "\":1}}") != DEJSON_INVALID_UTF8;
+      mismatches += validate<Test::Counter>("{\"" + before + str + "\":1}") != DEJSON_INVALID_UTF8;
+      mismatches += validate<Test::Counter>("{\"Unknown\":[\"" + before + str + "\"]}") != DEJSON_INVALID_UTF8;
+    }
+  }
+
+  CHECK(mismatches == 0);
+
+  dejson::document<Counter> doc = parse<Counter>("{\"Name\":\"\xc3\xa9\xe2\x82\xac\xf0\x9f\x98\x80\"}");
+  CHECK(doc && doc.view().Name() == "\xc3\xa9\xe2\x82\xac\xf0\x9f\x98\x80");
+}
+
+/* Copies the text into an allocation of its exact size, so reading past it is caught by the sanitizers */
+static std::unique_ptr<char[]> exact(std::string_view text)
+{
+  std::unique_ptr<char[]> copy(new char[text.size()]);
+  memcpy(copy.get(), text.data(), text.size());
+  return copy;
+}
+
+static void test_json_spans()
+{
+  std::string input = "{\"Kind\":\"counter\",\"Payload\": {\"Value\":7,\"Name\":\"seven\"} ,\"Items\":[{\"Kind\":\"inner\",\"Payload\":{\"Value\":1}},{}]}";
+  dejson::document<Envelope> doc = parse<Envelope>(input.c_str());
+  CHECK(doc && doc.view().Payload() == "{\"Value\":7,\"Name\":\"seven\"}" && doc.view().Items().size() == 2);
+
+  /* Spans are parsed from a copy in the buffer, so the result doesn't depend on the input */
+  std::string_view payload = doc.view().Payload();
+  std::unique_ptr<char[]> span = exact(payload);
+  size_t size;
+  CHECK(dejson::get_size<Counter>(&size, std::string_view(span.get(), payload.size())) == DEJSON_OK);
+
+  void* buffer = malloc(size);
+  CHECK(dejson::deserialize<Counter>(buffer, std::string_view(span.get(), payload.size())) == DEJSON_OK);
+  span.reset();
+  CHECK(((Counter*)buffer)->Value == 7 && strcmp(((Counter*)buffer)->Name.chars, "seven") == 0);
+  free(buffer);
+
+  std::string_view item = doc.view().Items()[0];
+  span = exact(item);
+  dejson::document<Envelope> inner = dejson::deserialize<Envelope>(std::string_view(span.get(), item.size()));
+  span.reset();
+  input.assign(input.size(), ' ');
+  CHECK(inner && inner.view().Kind() == "inner" && inner.view().Payload() == "{\"Value\":1}");
+  CHECK(dejson::deserialize<Counter>(inner.view().Payload()) && dejson::deserialize<Counter>(inner.view().Payload())->Value == 1);
+
+  /* Malformed spans fail without reading past their end */
+  static const char* const malformed[] =
+  {
+    "", " ", "{", "{\"Value\":1", "{\"Value\":", "{\"Name\":\"abc", "{\"Name\":\"abc\\", "{\"Name\":\"\\u12",
+    "{\"Value\":12", "{\"Value\":1.", "{\"Unknown\":[1,2", "{\"Unknown\":tru", "{\"Value\":1}}", "{\"Value\":1} x",
+  };
+
+  for (const char* text : malformed)
+  {
+    span = exact(text);
+    std::string_view view(span.get(), strlen(text));
+    CHECK(dejson::get_size<Counter>(&size, view) != DEJSON_OK);
+    CHECK(!dejson::deserialize<Counter>(view));
+  }
+
+  /* Spaces around the object are fine, but a NUL inside the span isn't */
+  span = exact(" {\"Value\":2} ");
+  CHECK(dejson::deserialize<Counter>(std::string_view(span.get(), 13))->Value == 2);
+  CHECK(dejson::get_size<Counter>(&size, std::string_view("{\"Value\":2}\0 ", 13)) == DEJSON_EOF_EXPECTED);
+  CHECK(dejson::get_size<Counter>(&size, std::string_view("{\"Value\":2}", 10)) != DEJSON_OK);
+}
+
+static std::string base64(const std::string& data, bool pad)
+{
+  static const char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+  std::string chars;
+
+  for (size_t i = 0; i < data.size(); i += 3)
+  {
+    uint32_t bits = (uint8_t)data[i] << 16;
+    bits |= i + 1 < data.size() ? (uint8_t)data[i + 1] << 8 : 0;
+    bits |= i + 2 < data.size() ? (uint8_t)data[i + 2] : 0;
+    size_t count = data.size() - i < 3 ? data.size() - i + 1 : 4;
+
+    for (size_t j = 0; j < count; j++)
+    {
+      chars += alphabet[bits >> (18 - j * 6) & 63];
+    }
+
+    chars.append(pad ? 4 - count : 0, '=');
+  }
+
+  return chars;
+}
+
+static void test_bytes()
+{
+  /* Lengths from empty to several 16-character blocks, so both the SSE2 and the scalar paths decode them */
+  unsigned mismatches = 0;
+  std::string data;
+
+  for (size_t length = 0; length < 100; length++)
+  {
+    for (bool pad : {false, true})
+    {
+      std::string json = "{\"Data\":\"" + base64(data, pad) + "\",\"Chunks\":[\"" + base64(data, pad) + "\",\"\"]}";
+      dejson::document<Blob> doc = parse<Blob>(json.c_str());
+      mismatches += !doc || doc.view().Data() != data || doc.view().Chunks().size() != 2;
+      mismatches += !doc || doc.view().Chunks()[0] != data || !doc.view().Chunks()[1].empty();
+    }
+
+    data += (char)(length * 37 + 11);
+  }
+
+  CHECK(mismatches == 0);
+
+  /* \/ is the only escape, and works inside a block too */
+  dejson::document<Blob> doc = parse<Blob>("{\"Data\":\"\\/\\/\\/\\/AAAAAAAAAAAAAAAAAAAAAAAA\"}");
+  CHECK(doc && doc.view().Data() == std::string("\xff\xff\xff", 3) + std::string(18, '\0'));
+  doc = parse<Blob>("{\"Data\":\"AAAAAAAAAAAA\\/\\/\\/\\/AAAAAAAAAAAA\"}");
+  CHECK(doc && doc.view().Data().size() == 21 && doc.view().Data()[9] == '\xff' && doc.view().Data()[11] == '\xff');
+
+  /* Bad characters fail wherever they are, in a block or in the tail */
+  mismatches = 0;
+
+  for (size_t i = 0; i < 40; i++)
+  {
+    for (const char* bad : {"!", "-", "_", " ", "\xc3\xa9", "\\n", "\\u0041", "=A"})
+    {
+      std::string chars(40, 'A');
+      chars.replace(i, 1, bad);
+      std::string json = "{\"Data\":\"" + chars + "\"}";
+      mismatches += error_of<Blob>(json.c_str()) != DEJSON_INVALID_VALUE;
+      mismatches += parse<Blob>(json.c_str()).error() != DEJSON_INVALID_VALUE;
+    }
+  }
+
+  CHECK(mismatches == 0);
+
+  /* A single character left over, and padding that doesn't complete a group */
+  CHECK(error_of<Blob>("{\"Data\":\"A\"}") == DEJSON_INVALID_VALUE);
+  CHECK(error_of<Blob>("{\"Data\":\"AAAAA\"}") == DEJSON_INVALID_VALUE);
+  CHECK(error_of<Blob>("{\"Data\":\"AA=\"}") == DEJSON_INVALID_VALUE);
+  CHECK(error_of<Blob>("{\"Data\":\"AA===\"}") == DEJSON_INVALID_VALUE);
+  CHECK(error_of<Blob>("{\"Data\":\"AAA==\"}") == DEJSON_INVALID_VALUE);
+  CHECK(error_of<Blob>("{\"Data\":\"=\"}") == DEJSON_INVALID_VALUE);
+  CHECK(error_of<Blob>("{\"Data\":\"AA==AA==\"}") == DEJSON_INVALID_VALUE);
+  CHECK(error_of<Blob>("{\"Data\":\"AAA=\"}") == DEJSON_OK && error_of<Blob>("{\"Data\":\"AA==\"}") == DEJSON_OK);
+  CHECK(error_of<Blob>("{\"Data\":\"AAAA") == DEJSON_UNTERMINATED_STRING);
+  CHECK(error_of<Blob>("{\"Data\":1}") == DEJSON_INVALID_VALUE);
+
+  /* Patches decode into the bounded overflow buffer */
+  patched<Blob> p("{\"Data\":\"AAAA\"}");
+  std::string patch = "{\"Data\":\"" + base64(std::string(50, 'x'), true) + "\"}";
+  CHECK(apply(p, "{\"Data\":\"AAAA\"}", {patch.c_str()}) == DEJSON_OK);
+  CHECK(p.doc.view().Data() == std::string(50, 'x'));
+}
+
+static void test_numbers()
+{
+  dejson::document<Numbers> doc = parse<Numbers>(
+    "{\"Small\":-128,\"Byte\":255,\"Int\":-2147483648,\"Uint\":4294967295,\"Big\":-9223372036854775808,"
+    "\"Huge\":18446744073709551615,\"Float\":-0.5,\"Double\":-0}");
+  CHECK(doc && doc->Small == -128 && doc->Byte == 255 && doc->Int == INT32_MIN && doc->Uint == UINT32_MAX);
+  CHECK(doc->Big == INT64_MIN && doc->Huge == UINT64_MAX && doc->Float == -0.5f && doc->Double == 0.0);
+
+  /* Doubles are correctly rounded on both sides of the fast path */
+  doc = parse<Numbers>("{\"Double\":9007199254740993,\"Big\":9007199254740993,\"Huge\":0}");
+  CHECK(doc && doc->Double == 9007199254740992.0 && doc->Big == 9007199254740993LL);
+  CHECK(parse<Numbers>("{\"Double\":1e23}")->Double == 1e23);
+  CHECK(parse<Numbers>("{\"Double\":-1e23}")->Double == -1e23);
+  CHECK(parse<Numbers>("{\"Double\":8.98846567431158e307}")->Double == 8.98846567431158e307);
+  CHECK(parse<Numbers>("{\"Double\":0.1}")->Double == 0.1 && parse<Numbers>("{\"Double\":-1.5E-3}")->Double == -1.5e-3);
+  CHECK(parse<Numbers>("{\"Double\":123456789012345678901234567890}")->Double == 123456789012345678901234567890.0);
+  CHECK(parse<Numbers>("{\"Double\":0.000001e+6}")->Double == 1.0 && parse<Numbers>("{\"Double\":0e10}")->Double == 0.0);
+
+  /* Values that don't fit */
+  static const char* const overflows[] =
+  {
+    "{\"Small\":128}", "{\"Small\":-129}", "{\"Byte\":256}", "{\"Byte\":-1}", "{\"Int\":2147483648}",
+    "{\"Uint\":4294967296}", "{\"Big\":9223372036854775808}", "{\"Big\":-9223372036854775809}",
+    "{\"Huge\":18446744073709551616}", "{\"Huge\":100000000000000000000}", "{\"Float\":1e39}",
+    "{\"Double\":1e309}", "{\"Double\":-1e309}", "{\"Ints\":[1,2147483648]}", "{\"Huges\":[-1]}",
+  };
+
+  for (const char* json : overflows)
+  {
+    CHECK(error_of<Numbers>(json) == DEJSON_INVALID_VALUE);
+  }
+
+  CHECK(parse<Numbers>("{\"Byte\":-0}") && parse<Numbers>("{\"Byte\":-0}")->Byte == 0);
+
+  /* Anything outside the JSON grammar, in fields, arrays, and skipped values */
+  static const char* const malformed[] =
+  {
+    "0001", "-01", "00", "-00", "01.5", "1.", "-1.", "1.e5", ".5", "-", "+1", "-.5", "0x10", "Infinity",
+    "-Infinity", "NaN", "1e", "1e+", "1.5e-", "--1", "1 2",
+  };
+
+  for (const char* number : malformed)
+  {
+    for (const char* field : {"Int", "Huge", "Double", "Float", "Unknown"})
+    {
+      std::string json = std::string("{\"") + field + "\":" + number + "}";
+      int res = error_of<Numbers>(json.c_str());
+      CHECK(res != DEJSON_OK && res == validate<Test::Numbers>(json));
+      CHECK(!parse<Numbers>(json.c_str()));
+    }
+
+    for (const char* field : {"Ints", "Huges", "Doubles"})
+    {
+      std::string json = std::string("{\"") + field + "\":[1," + number + ",2]}";
+      CHECK(error_of<Numbers>(json.c_str()) != DEJSON_OK && validate<Test::Numbers>(json) != DEJSON_OK);
+    }
+  }
+
+  /* Zero is fine on its own and in front of a fraction or an exponent */
+  doc = parse<Numbers>("{\"Int\":0,\"Big\":-0,\"Double\":0.5,\"Float\":-0e1,\"Unknown\":[0,-0.0,0E-2]}");
+  CHECK(doc && doc->Int == 0 && doc->Big == 0 && doc->Double == 0.5 && doc->Float == 0.0f);
+
+  /* Arrays of numbers are parsed straight into their elements */
+  doc = parse<Numbers>("{\"Ints\":[ 1 , -2,2147483647,-2147483648 ],\"Huges\":[18446744073709551615,0],\"Doubles\":[1e23,-0.25,9007199254740993]}");
+  CHECK(doc && doc.view().Ints().size() == 4 && doc.view().Ints()[1] == -2 && doc.view().Ints()[3] == INT32_MIN);
+  CHECK(doc.view().Huges().size() == 2 && doc.view().Huges()[0] == UINT64_MAX);
+  CHECK(doc.view().Doubles().size() == 3 && doc.view().Doubles()[0] == 1e23 && doc.view().Doubles()[2] == 9007199254740992.0);
+
+  doc = parse<Numbers>("{\"Ints\":[],\"Doubles\":[ ]}");
+  CHECK(doc && doc.view().Ints().empty() && doc.view().Doubles().empty());
+
+  std::string json = "{\"Ints\":[";
+
+  for (int i = 0; i < 1000; i++)
+  {
+    json += (i == 0 ? "" : ",") + std::to_string(i * 1000 - 500000);
+  }
+
+  json += "]}";
+  doc = parse<Numbers>(json.c_str());
+  CHECK(doc && doc.view().Ints().size() == 1000 && doc.view().Ints()[0] == -500000 && doc.view().Ints()[999] == 499000);
+
+  CHECK(error_of<Numbers>("{\"Ints\":[,1]}") != DEJSON_OK);
+  CHECK(error_of<Numbers>("{\"Ints\":[1 2]}") != DEJSON_OK);
+  CHECK(error_of<Numbers>("{\"Ints\":[1,2}") != DEJSON_OK);
+  CHECK(error_of<Numbers>("{\"Ints\":[1.5]}") != DEJSON_OK);
+  CHECK(error_of<Numbers>("{\"Ints\":[\"1\"]}") == DEJSON_INVALID_VALUE);
+}
+
+static void test_optionals()
+{
+  dejson::document<Options> doc = parse<Options>(
+    "{\"Title\":\"t\",\"Count\":0,\"Enabled\":false,\"Tint\":\"Blue\",\"Settings\":{\"Volume\":3},\"Extra\":[1],"
+    "\"Blob\":\"AQI=\",\"Mask\":\"ff\",\"Id\":\"5\",\"Plain\":1}");
+  CHECK(doc);
+
+  /* Present values are told apart from zeros, whatever their type */
+  Test::Options view = doc.view();
+  CHECK(view.Title() == "t" && view.Count() == 0u && view.Enabled() == false && view.Tint() == Color_Blue);
+  CHECK(view.Settings().has_value() && view.Settings()->Volume() == 3 && view.Extra() == "[1]");
+  CHECK(view.Blob() == std::string_view("\x01\x02", 2) && view.Mask() == 0xffu && view.Id() == 5u && view.Plain() == 1);
+  CHECK(!view.Title_is_null() && !view.Count_is_null() && !view.Enabled_is_null() && !view.Mask_is_null());
+
+  /* Every field has its own pair of bits, across the bytes of the bitmap */
+  CHECK(sizeof(doc->dejson_presence) == 3);
+  const int bits[] =
+  {
+    Options_Title_BIT, Options_Count_BIT, Options_Enabled_BIT, Options_Tint_BIT, Options_Settings_BIT,
+    Options_Extra_BIT, Options_Blob_BIT, Options_Mask_BIT, Options_Id_BIT,
+  };
+  const char* const names[] = {"Title", "Count", "Enabled", "Tint", "Settings", "Extra", "Blob", "Mask", "Id"};
+  unsigned mismatches = 0;
+
+  for (size_t i = 0; i < 9; i++)
+  {
+    std::string json = std::string("{\"") + names[i] + "\":null}";
+    dejson::document<Options> one = parse<Options>(json.c_str());
+    mismatches += !one;
+
+    for (size_t j = 0; one && j < 9; j++)
+    {
+      mismatches += DEJSON_IS_PRESENT(*one, bits[j]) != 0 || (DEJSON_IS_NULL(*one, bits[j]) != 0) != (i == j);
+    }
+  }
+
+  CHECK(mismatches == 0);
+
+  /* null and missing values are zeroed, and only null ones are flagged */
+  doc = parse<Options>("{\"Title\":null,\"Count\":null,\"Settings\":null,\"Extra\":null,\"Mask\":null,\"Id\":null}");
+  view = doc.view();
+  CHECK(doc && !view.Title() && view.Title_is_null() && !view.Count() && view.Count_is_null());
+  CHECK(!view.Settings() && view.Settings_is_null() && !view.Extra() && view.Extra_is_null());
+  CHECK(!view.Mask() && view.Mask_is_null() && !view.Id() && view.Id_is_null());
+  CHECK(!view.Enabled() && !view.Enabled_is_null() && !view.Blob() && !view.Blob_is_null() && !view.Tint_is_null());
+  CHECK(doc->Title.chars == NULL && doc->Count == 0 && doc->Settings.Volume == 0 && doc->Extra.chars == NULL);
+
+  doc = parse<Options>("{}");
+  CHECK(doc && doc->dejson_presence[0] == 0 && doc->dejson_presence[1] == 0 && doc->dejson_presence[2] == 0);
+
+  /* Only optional fields take null */
+  CHECK(error_of<Options>("{\"Plain\":null}") == DEJSON_INVALID_VALUE);
+  CHECK(error_of<Options>("{\"Count\":nul}") != DEJSON_OK);
+  CHECK(error_of<Options>("{\"Count\":\"1\"}") == DEJSON_INVALID_VALUE);
+
+  /* In patches, values set the present bit and null makes fields missing */
+  const char* json = "{\"Title\":\"t\",\"Count\":null,\"Settings\":{\"Volume\":3}}";
+  patched<Options> p(json);
+  CHECK(apply(p, json, {"{\"Title\":null,\"Count\":4,\"Settings\":{\"Theme\":\"x\"},\"Enabled\":true}"}) == DEJSON_OK);
+  view = p.doc.view();
+  CHECK(!view.Title() && !view.Title_is_null() && view.Count() == 4u && !view.Count_is_null() && view.Enabled() == true);
+  CHECK(view.Settings().has_value() && view.Settings()->Volume() == 3 && view.Settings()->Theme() == "x");
+
+  CHECK(apply(p, json, {"{\"Settings\":null,\"Count\":null}"}) == DEJSON_OK);
+  CHECK(!p.doc.view().Settings() && !p.doc.view().Settings_is_null() && !p.doc.view().Count() && !p.doc.view().Count_is_null());
+}
+
+/* Collects the elements of a walk, stopping after limit of them */
+struct walked
+{
+  std::vector<std::pair<unsigned, std::string>> elements;
+  size_t limit = SIZE_MAX;
+};
+
+static int walk(walked& w, const char* json, const char* path, size_t scratch_size = 1024, dejson_feed_t* feed = NULL)
+{
+  std::vector<uint64_t> scratch(scratch_size / 8 + 1);
+
+  return dejson::foreach<Counter>((void*)scratch.data(), scratch_size, (const uint8_t*)json, path, [&w](const Counter& c, size_t index) {
+    w.elements.emplace_back(c.Value, c.Name.chars != NULL ? c.Name.chars : "");
+    return index + 1 < w.limit;
+  }, feed);
+}
+
+/* Gives the input to the parser a few bytes at a time, at the points dejson_feed_cut finds */
+struct trickle : dejson_feed_t
+{
+  explicit trickle(const std::string& input, size_t step) : text(input), step(step)
+  {
+    more = next;
+    hold(0);
+  }
+
+  void hold(size_t begin)
+  {
+    length = std::min(begin + step, text.size());
+    cut = length == text.size() ? length : dejson_feed_cut((const uint8_t*)text.data(), begin, length, cut, &in_string);
+    held = text[cut];
+    text[cut] = 0;
+  }
+
+  static int next(dejson_feed_t* feed, const uint8_t* json)
+  {
+    trickle* self = static_cast<trickle*>(feed);
+    size_t pos = json - (const uint8_t*)self->text.data();
+
+    if (pos < self->cut || self->length == self->text.size())
+    {
+      return 0;
+    }
+
+    self->text[self->cut] = self->held;
+    self->calls++;
+    self->hold(self->length);
+    return 1;
+  }
+
+  std::string text;
+  size_t step, length = 0, cut = 0, calls = 0;
+  int in_string = 0;
+  char held = 0;
+};
+
+static void test_foreach()
+{
+  const char* json =
+    "{\"Skip\":[1,{\"Items\":[{\"Value\":9}]}],\"A\":{\"Other\":1,\"B\":{\"Items\":[{\"Value\":1,\"Name\":\"a\"}, {\"Value\":2}]},"
+    "\"After\":{\"k\":[1]}},\"Tail\":\"t\"}";
+
+  /* Nested paths only match at their own level */
+  walked w;
+  CHECK(walk(w, json, "A.B.Items") == DEJSON_OK && w.elements.size() == 2);
+  CHECK(w.elements[0] == std::make_pair(1u, std::string("a")) && w.elements[1] == std::make_pair(2u, std::string()));
+
+  w = walked();
+  CHECK(walk(w, json, "Items") == DEJSON_OK && w.elements.empty());
+  CHECK(walk(w, json, "A.Missing.Items") == DEJSON_OK && w.elements.empty());
+  CHECK(walk(w, "{\"A\":null}", "A.B") == DEJSON_OK && w.elements.empty());
+  CHECK(walk(w, "{\"A\":{\"B\":[]}}", "A.B") == DEJSON_OK && walk(w, "{\"A\":{\"B\":[ ]}}", "A.B") == DEJSON_OK && w.elements.empty());
+  CHECK(walk(w, "[]", "") == DEJSON_OK && walk(w, " [ {\"Value\":3} ] ", "") == DEJSON_OK && w.elements.size() == 1);
+
+  /* Stopping early skips the rest of the document, even if it's malformed */
+  w = walked();
+  w.limit = 1;
+  CHECK(walk(w, "{\"A\":{\"B\":[{\"Value\":1},{\"Value\":2}]},\"Tail\":tru", "A.B") == DEJSON_OK && w.elements.size() == 1);
+
+  /* Elements before a malformed one are passed on, and so is everything before malformed input after the array */
+  w = walked();
+  CHECK(walk(w, "{\"A\":{\"B\":[{\"Value\":1},{\"Value\":x},{\"Value\":3}]}}", "A.B") == DEJSON_INVALID_VALUE && w.elements.size() == 1);
+  CHECK(walk(w, "{\"A\":{\"B\":[{\"Value\":1},2]}}", "A.B") == DEJSON_INVALID_VALUE && w.elements.size() == 2);
+  CHECK(walk(w, "{\"A\":{\"B\":[{\"Value\":1}]},\"Tail\":tru}", "A.B") != DEJSON_OK && w.elements.size() == 3);
+  CHECK(walk(w, "{\"A\":{\"B\":[{\"Value\":1}", "A.B") != DEJSON_OK);
+  CHECK(walk(w, "{\"A\":{\"B\":{}}}", "A.B") == DEJSON_INVALID_VALUE);
+  CHECK(walk(w, "{\"A\":[]}", "A.B") == DEJSON_INVALID_VALUE);
+  CHECK(walk(w, "{\"A\":{\"B\":[{\"Value\":1}]}} x", "A.B") == DEJSON_EOF_EXPECTED);
+
+  /* The rest of the document is checked the same way after the walk */
+  w = walked();
+  CHECK(walk(w, "{\"A\":[{\"Value\":1}],\"B\":{\"x\":[1,2],\"y\":{\"z\":\"\\u00e9\"}},\"C\":[[],{}]}", "A") == DEJSON_OK && w.elements.size() == 1);
+  CHECK(walk(w, "{\"A\":[{\"Value\":1}],\"B\":{\"x\":\"\\u12\"}}", "A") == DEJSON_INVALID_ESCAPE);
+
+  /* The scratch buffer must hold each element */
+  w = walked();
+  CHECK(walk(w, "[{\"Value\":1,\"Name\":\"a long enough name\"}]", "", sizeof(Counter)) == DEJSON_OUT_OF_MEMORY && w.elements.empty());
+
+  /* With a feed, elements are passed on before the input is complete */
+  std::string large = "{\"Items\":[";
+
+  for (unsigned i = 0; i < 100; i++)
+  {
+    large += (i == 0 ? "{\"Value\":" : ", {\"Value\":") + std::to_string(i) + ",\"Name\":\"n" + std::to_string(i) + "\"}";
+  }
+
+  large += "],\"Tail\":[1,2,3]}";
+  trickle feed(large, 7);
+  std::vector<size_t> received;
+  std::vector<uint64_t> scratch(128);
+  int res = dejson::foreach<Counter>((void*)scratch.data(), 1024, (const uint8_t*)feed.text.data(), "Items", [&](const Counter& c, size_t index) {
+    received.push_back(feed.length);
+    return c.Value == index && std::string(c.Name.chars) == "n" + std::to_string(index);
+  }, &feed);
+  CHECK(res == DEJSON_OK && received.size() == 100 && received[0] < large.size() / 10 && feed.calls > 100);
+}
+
+/* Returns the error of json if every entry point agrees on it, or -1 */
+template<typename T, typename V>
+static int agreed_error(const std::string& json)
+{
+  int res = error_of<T>(json.c_str());
+  return parse<T>(json.c_str()).error() == res && validate<V>(json) == res ? res : -1;
+}
+
+static void test_sticky_errors()
+{
+  /* The first error comes out of any nesting, as the same code everywhere */
+  CHECK((agreed_error<Catalog, Test::Catalog>("{\"Plain\":[{\"Id\":1},{\"Id\":x}]}")) == DEJSON_INVALID_VALUE);
+  CHECK((agreed_error<Counter, Test::Counter>("{\"Unknown\":[[[[1,[2,{\"a\":[x]}]]]]]}")) == DEJSON_INVALID_VALUE);
+  CHECK((agreed_error<Profile, Test::Profile>("{\"Settings\":{\"Levels\":[1,2,-3]}}")) == DEJSON_INVALID_VALUE);
+  CHECK((agreed_error<Profile, Test::Profile>("{\"Named\":{\"a\":{\"Levels\":[1]},\"b\":{\"Levels\":[1,2,x]}}}")) == DEJSON_INVALID_VALUE);
+  CHECK((agreed_error<Profile, Test::Profile>("{\"Named\":{\"a\":{\"Theme\":\"\\u12\"}}}")) == DEJSON_INVALID_ESCAPE);
+  CHECK((agreed_error<Profile, Test::Profile>("{\"Backup\":{\"Theme\":\"\xff\"}}")) == DEJSON_INVALID_UTF8);
+  CHECK((agreed_error<Maps, Test::Maps>("{\"Counters\":{\"x\":{\"Value\":1},\"y\":{\"Value\":\"2\"}}}")) == DEJSON_INVALID_VALUE);
+  CHECK((agreed_error<Maps, Test::Maps>("{\"Counters\":{\"x\":{\"Value\":1,\"Name\":\"a}}}")) == DEJSON_UNTERMINATED_STRING);
+  CHECK((agreed_error<Options, Test::Options>("{\"Settings\":{\"Levels\":[1,\"x\"]}}")) == DEJSON_INVALID_VALUE);
+  CHECK((agreed_error<Options, Test::Options>("{\"Settings\":{\"Volume\":1},\"Blob\":\"A\"}")) == DEJSON_INVALID_VALUE);
+  CHECK((agreed_error<Options, Test::Options>("{\"Extra\":[1,{\"a\":}]}")) != DEJSON_OK);
+  CHECK((agreed_error<Palette, Test::Palette>("{\"Named\":{\"a\":\"Red\",\"b\":3}}")) == DEJSON_INVALID_VALUE);
+
+  /* Only the first error is kept, and nothing runs after it */
+  CHECK((agreed_error<Counter, Test::Counter>("{\"Value\":x,\"Name\":\"\\u12\"}")) == DEJSON_INVALID_VALUE);
+  CHECK((agreed_error<Profile, Test::Profile>("{\"Named\":{\"a\":{\"Volume\":-1}},\"Backup\":{\"Theme\":\"\\u12\"}}")) == DEJSON_INVALID_VALUE);
+
+  hex_calls = 0;
+  CHECK(parse<Quoted>("{\"Id\":\"x\",\"Hex\":\"ff\",\"Hexes\":[\"1\"]}").error() == DEJSON_INVALID_VALUE);
+  CHECK(parse<Options>("{\"Settings\":{\"Volume\":\"1\"},\"Mask\":\"ff\"}").error() == DEJSON_INVALID_VALUE);
+  CHECK(hex_calls == 0);
+
+  /* Callbacks don't see elements after an error either */
+  walked w;
+  CHECK(walk(w, "[{\"Value\":1},{\"Value\":2,\"Unknown\":[[x]]},{\"Value\":3}]", "") == DEJSON_INVALID_VALUE && w.elements.size() == 1);
+
+  /* Patches stop at the first error too, at any depth */
+  const char* profile = "{\"Name\":\"a\",\"Named\":{\"a\":{\"Volume\":1}},\"Settings\":{\"Levels\":[1]}}";
+  static const char* const patches[] =
+  {
+    "{\"Named\":{\"a\":{\"Levels\":[1,x]}}}",
+    "{\"Named\":{\"b\":{\"Volume\":1},\"c\":{\"Theme\":1}}}",
+    "{\"Settings\":{\"Levels\":[[1]]}}",
+    "{\"Backup\":{\"Volume\":1,\"Theme\":\"\\u12\"}}",
+  };
+
+  for (const char* patch : patches)
+  {
+    patched<Profile> p(profile);
+    size_t size;
+    std::vector<uint64_t> overflow(512);
+    int res = dejson_get_patch_size(&size, (const void*)p.doc.get(), g_MetaProfile.name_hash, (const uint8_t*)patch);
+    CHECK(res != DEJSON_OK);
+    CHECK(dejson_apply_patch((void*)p.doc.get(), (void*)overflow.data(), overflow.size() * 8, g_MetaProfile.name_hash, (const uint8_t*)patch) == res);
+  }
+}
+
+int main()
+{
+  test_maps();
+  test_indexed_arrays();
+  test_patches();
+  test_depth();
+  test_enums();
+  test_quoted();
+  test_validate();
+  test_json_spans();
+  test_bytes();
+  test_numbers();
+  test_optionals();
+  test_foreach();
+  test_sticky_errors();
+
+  printf("%s\n", failures == 0 ? "ok" : "FAILED");
+  return failures != 0;
+}